@@ -0,0 +1,107 @@
+#pragma once
+
+#include "MyMath.h"
+#include "RasterKernel.h"
+#include "RenderTarget.h"
+
+// Guard band half-width in pixels: triangles are only clipped against the sides once they reach this far off
+// screen, anything inside stays within the rasterizer's fixed-point range (FIXED_POINT_LIMIT)
+const float GUARD_BAND_PIXELS = FIXED_POINT_LIMIT / 4;
+
+// Most vertices a triangle clipped against five planes can turn into
+const int MAX_CLIP_VERTICES = 8;
+
+// Clip-Space Vertex (weights.x / y / z = how much of the original triangle's v0 / v1 / v2 it is made of,
+// so any vertex attribute can be rebuilt for it)
+struct ClipVertex {
+	Vec4 position;
+	Vec4 weights;
+};
+
+// Homogeneous Clipper
+// Clips clip-space triangles (before the perspective divide) against the near plane (z >= 0, or z <= w for a
+// reversed-Z target) and a guard band far outside the screen. Triangles that cross no plane, which is nearly
+// all of them, are passed through untouched. The far plane needs no clipping, fragments past it fail the depth
+// test against the cleared depth.
+class Clipper {
+private:
+	float guardX = 1.f;	 // Guard band in NDC units, |x| <= guardX * w
+	float guardY = 1.f;	 // |y| <= guardY * w
+	bool reversedZ = false;	 // Near plane at z = w instead of z = 0
+
+	// Signed distances to the five planes (inside >= 0)
+	void distances(const Vec4& p, float d[5]) const {
+		d[0] = reversedZ ? p.w - p.z : p.z;	 // Near
+		d[1] = guardX * p.w - p.x;		 // Right
+		d[2] = guardX * p.w + p.x;		 // Left
+		d[3] = guardY * p.w - p.y;		 // Bottom (NDC y is up)
+		d[4] = guardY * p.w + p.y;		 // Top
+	}
+
+public:
+	// Constructor (the guard band scales with the target so it is the same number of pixels on every side)
+	Clipper(const RenderTarget& target) : reversedZ(target.getDepthFormat() == DepthFormat::ReversedFloat32) {
+		guardX = 1.f + 2.f * GUARD_BAND_PIXELS / target.getWidth();
+		guardY = 1.f + 2.f * GUARD_BAND_PIXELS / target.getHeight();
+	}
+
+	// Outcode bit per plane the point is outside of (0 = nothing to clip)
+	int outcode(const Vec4& p) const {
+		float d[5];
+		distances(p, d);
+		int code = 0;
+		for (int i = 0; i < 5; i++) if (!(d[i] >= 0.f)) code |= 1 << i;  // NaN counts as outside
+		return code;
+	}
+
+	// Clip a triangle and call emit(a, b, c) with each resulting ClipVertex triangle (same winding as the input),
+	// returns true if it crossed a plane and had to be cut
+	template<typename Emit>
+	bool clipTriangle(const Vec4& c0, const Vec4& c1, const Vec4& c2, Emit&& emit) const {
+		int code0 = outcode(c0), code1 = outcode(c1), code2 = outcode(c2);
+		if (code0 & code1 & code2) return false;  // All three outside the same plane
+
+		ClipVertex in[MAX_CLIP_VERTICES], out[MAX_CLIP_VERTICES];
+		in[0] = { c0, Vec4(1.f, 0.f, 0.f, 0.f) };
+		in[1] = { c1, Vec4(0.f, 1.f, 0.f, 0.f) };
+		in[2] = { c2, Vec4(0.f, 0.f, 1.f, 0.f) };
+		if ((code0 | code1 | code2) == 0) {	 // Trivially inside
+			emit(in[0], in[1], in[2]);
+			return false;
+		}
+
+		// Sutherland-Hodgman, one plane at a time (only the planes some vertex is outside of)
+		int count = 3;
+		int planes = code0 | code1 | code2;
+		ClipVertex* src = in;
+		ClipVertex* dst = out;
+		for (int plane = 0; plane < 5 && count >= 3; plane++) {
+			if (!(planes & (1 << plane))) continue;
+
+			float d[MAX_CLIP_VERTICES];
+			for (int i = 0; i < count; i++) {
+				float all[5];
+				distances(src[i].position, all);
+				d[i] = all[plane];
+			}
+
+			int kept = 0;
+			for (int i = 0; i < count; i++) {
+				int j = (i + 1) % count;
+				bool insideI = d[i] >= 0.f, insideJ = d[j] >= 0.f;
+				if (insideI) dst[kept++] = src[i];
+				if (insideI != insideJ) {
+					float t = d[i] / (d[i] - d[j]);
+					dst[kept++] = { src[i].position + (src[j].position - src[i].position) * t,
+									src[i].weights + (src[j].weights - src[i].weights) * t };
+				}
+			}
+			count = kept;
+			std::swap(src, dst);
+		}
+
+		// Fan out the convex polygon
+		for (int i = 1; i + 1 < count; i++) emit(src[0], src[i], src[i + 1]);
+		return true;
+	}
+};
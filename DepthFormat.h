@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+
+// Depth Buffer Formats
+//   Float32          z in [0, 1] as float, near = 0, cleared to 1 (the default)
+//   ReversedFloat32  z in [0, 1] as float, near = 1, cleared to 0 (Matrix::projection maps z the other way round),
+//                    float precision then piles up where perspective z loses it, so far depths stay distinct
+//   Unorm24          z * (2^24 - 1) rounded, in 32-bit words (the top byte is unused)
+//   Unorm16          z * (2^16 - 1) rounded, half the bandwidth for depth-only and occlusion passes
+enum class DepthFormat { Float32, ReversedFloat32, Unorm24, Unorm16 };
+
+// Depth Format Traits
+// What the rasterizer specialises its depth test and write on. Each format stores encode(z), keeps the new value
+// where closer(new, old), and clears to clearValue(). key() maps a stored value onto a float that grows with
+// distance from the viewer in every format, which is what the Hi-Z keeps per cell.
+struct DepthFloat32 {
+	typedef float Storage;
+	static const bool REVERSED = false;
+
+	static Storage clearValue() { return 1.f; }
+	static Storage encode(float z) { return z; }
+	static bool closer(Storage value, Storage old) { return value < old; }
+	static float key(Storage value) { return value; }
+	static float decode(Storage value) { return value; }
+};
+
+struct DepthReversedFloat32 {
+	typedef float Storage;
+	static const bool REVERSED = true;
+
+	static Storage clearValue() { return 0.f; }
+	static Storage encode(float z) { return z; }
+	static bool closer(Storage value, Storage old) { return value > old; }
+	static float key(Storage value) { return -value; }
+	static float decode(Storage value) { return value; }
+};
+
+template<int BITS, typename StorageType>
+struct DepthUnorm {
+	typedef StorageType Storage;
+	static const bool REVERSED = false;
+	static const uint32_t MAX = (1u << BITS) - 1;
+
+	static Storage clearValue() { return static_cast<Storage>(MAX); }
+
+	// Round to the nearest step, out of range and NaN saturate (the SIMD kernels do the same operations)
+	static Storage encode(float z) {
+		float scaled = z * static_cast<float>(MAX);
+		scaled = scaled > 0.f ? (scaled < static_cast<float>(MAX) ? scaled : static_cast<float>(MAX)) : 0.f;
+		uint32_t value = static_cast<uint32_t>(scaled + 0.5f);
+		return static_cast<Storage>(value < MAX ? value : MAX);
+	}
+	static bool closer(Storage value, Storage old) { return value < old; }
+	static float key(Storage value) { return static_cast<float>(value); }
+	static float decode(Storage value) { return value * (1.f / MAX); }
+};
+
+typedef DepthUnorm<24, uint32_t> DepthUnorm24;
+typedef DepthUnorm<16, uint16_t> DepthUnorm16;
+
+// Names used on the command line ("float", "reversed", "unorm24", "unorm16")
+static const char* depthFormatName(DepthFormat format) {
+	switch (format) {
+	case DepthFormat::ReversedFloat32: return "reversed";
+	case DepthFormat::Unorm24: return "unorm24";
+	case DepthFormat::Unorm16: return "unorm16";
+	default: return "float";
+	}
+}
+
+// Parse a depth format name, returns false if unknown
+static bool parseDepthFormat(const std::string& name, DepthFormat& format) {
+	for (DepthFormat f : { DepthFormat::Float32, DepthFormat::ReversedFloat32, DepthFormat::Unorm24, DepthFormat::Unorm16 }) {
+		if (name == depthFormatName(f)) {
+			format = f;
+			return true;
+		}
+	}
+	return false;
+}
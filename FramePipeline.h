@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "JobSystem.h"
+#include "RenderTarget.h"
+
+// Handoff Queue (lock-free ring between exactly one producer and one consumer thread, push fails when full and
+// pop when empty)
+template<typename T>
+class HandoffQueue {
+private:
+	std::vector<T> items;				  // One spare entry tells full from empty
+	std::atomic<size_t> head{ 0 };		  // Next entry to pop (written by the consumer)
+	std::atomic<size_t> tail{ 0 };		  // Next entry to push (written by the producer)
+
+public:
+	// Constructor (room for capacity items)
+	HandoffQueue(size_t capacity) : items(capacity + 1) {}
+
+	bool push(const T& item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t next = (t + 1) % items.size();
+		if (next == head.load(std::memory_order_acquire)) return false;
+		items[t] = item;
+		tail.store(next, std::memory_order_release);  // Publishes the item
+		return true;
+	}
+
+	bool pop(T& item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		item = items[h];
+		head.store((h + 1) % items.size(), std::memory_order_release);	// Hands the entry back
+		return true;
+	}
+};
+
+// Pipelined Frame Executor
+// The calling (app) thread builds frame N + 1 (Frame holds whatever the raster stage needs, e.g. assembled
+// geometry) while a raster thread rasterizes frame N into its own render target, and presents frame N - 1
+// meanwhile. Every frame in flight owns one of the targets, so their number is the latency limit: 1 runs the
+// stages strictly one after another, 2 double-buffers colour and depth, 3 triple-buffers. Frames are handed
+// over in order through two handoff queues, so the output is the same as rendering them serially. While a
+// thread waits for the other one it runs queued jobs.
+template<typename Frame>
+class FramePipeline {
+public:
+	typedef std::function<void(Frame& frame, RenderTarget& target)> RasterStage;
+
+private:
+	static const size_t STOP = ~static_cast<size_t>(0);	 // Slot index that ends the raster thread
+
+	// Frame in flight and the target it is rasterized into
+	struct Slot {
+		Frame frame;
+		RenderTarget* target;
+	};
+
+	JobSystem& jobs;
+	RasterStage rasterStage;
+	std::vector<Slot> slots;
+	std::vector<size_t> freeSlots;	 // Slots the app thread can build into (only the app thread uses these)
+	HandoffQueue<size_t> built;		 // App -> raster thread
+	HandoffQueue<size_t> rasterized; // Raster -> app thread
+	std::thread rasterThread;
+
+	// Help with jobs, or give up the time slice when there are none
+	void idle() {
+		if (!jobs.runPending()) std::this_thread::yield();
+	}
+
+	void rasterLoop() {
+		while (true) {
+			size_t slot;
+			while (!built.pop(slot)) idle();
+			if (slot == STOP) return;
+
+			rasterStage(slots[slot].frame, *slots[slot].target);
+			while (!rasterized.push(slot)) idle();
+		}
+	}
+
+	// Wait for the oldest frame in flight and present it, which frees its slot
+	template<typename Present>
+	void retire(Present& present) {
+		size_t slot;
+		while (!rasterized.pop(slot)) idle();
+		present(*slots[slot].target);
+		freeSlots.push_back(slot);
+	}
+
+public:
+	// Constructor (one frame in flight per target, the raster stage runs on its own thread and jobs)
+	FramePipeline(JobSystem& _jobs, const std::vector<RenderTarget*>& targets, RasterStage _rasterStage)
+		: jobs(_jobs), rasterStage(_rasterStage), slots(targets.size()), built(targets.size() + 1), rasterized(targets.size()) {
+		for (size_t i = 0; i < targets.size(); i++) {
+			slots[i].target = targets[i];
+			freeSlots.push_back(targets.size() - 1 - i);
+		}
+		rasterThread = std::thread(&FramePipeline::rasterLoop, this);
+	}
+
+	~FramePipeline() {
+		while (!built.push(STOP)) idle();
+		rasterThread.join();
+	}
+
+	FramePipeline(const FramePipeline&) = delete;
+	FramePipeline& operator=(const FramePipeline&) = delete;
+
+	// Build the next frame with build(frame, target) on this thread and hand it to the raster thread. When the
+	// latency limit is reached the oldest frame is waited for and passed to present(target) first.
+	template<typename Build, typename Present>
+	void submit(Build&& build, Present&& present) {
+		if (freeSlots.empty()) retire(present);
+		size_t slot = freeSlots.back();
+		freeSlots.pop_back();
+
+		build(slots[slot].frame, static_cast<const RenderTarget&>(*slots[slot].target));
+		built.push(slot);  // Room for every slot
+	}
+
+	// Present every frame still in flight
+	template<typename Present>
+	void finish(Present&& present) {
+		while (freeSlots.size() < slots.size()) retire(present);
+	}
+
+	// Frames that can be in flight at once
+	size_t latency() const { return slots.size(); }
+};
+
+// Out-of-class definition, push() binds STOP to a reference (C++14 has no inline variables)
+template<typename Frame>
+const size_t FramePipeline<Frame>::STOP;
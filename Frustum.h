@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "MyMath.h"
+
+// Axis-Aligned Bounding Box (empty until something is added)
+struct AABB {
+	Vec3 minimum = Vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	Vec3 maximum = Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	bool empty() const { return minimum.x > maximum.x; }
+	Vec3 centre() const { return (minimum + maximum) * 0.5f; }
+
+	void extend(const Vec3& p) {
+		minimum = Vec3(std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z));
+		maximum = Vec3(std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z));
+	}
+	void extend(const AABB& box) {
+		if (box.empty()) return;
+		extend(box.minimum);
+		extend(box.maximum);
+	}
+};
+
+// Bounds of a box after an affine transform (Arvo: each output extent sums the smaller and larger products of
+// the matrix row with the input extents, tight for the transformed box)
+static AABB transformAABB(const AABB& box, const Transform& t) {
+	if (box.empty()) return box;
+	AABB out;
+	for (int r = 0; r < 3; r++) {
+		float lo = t[r * 4 + 3], hi = lo;
+		for (int c = 0; c < 3; c++) {
+			float a = t[r * 4 + c] * box.minimum.v[c];
+			float b = t[r * 4 + c] * box.maximum.v[c];
+			lo += std::min(a, b);
+			hi += std::max(a, b);
+		}
+		out.minimum.v[r] = lo;
+		out.maximum.v[r] = hi;
+	}
+	return out;
+}
+
+// View Frustum
+// The six planes of a view-projection matrix (-w <= x <= w, -w <= y <= w and 0 <= z <= w, which also holds with
+// reversed depth) in the space the matrix maps from, normalized so plane distances are in that space's units.
+struct Frustum {
+	static const int PLANES = 6;
+	static const unsigned int ALL_PLANES = (1u << PLANES) - 1;
+
+	Vec4 planes[PLANES];  // Inside where dot(plane, (p, 1)) >= 0
+
+	// Result of a box test (Intersecting boxes still need their contents tested)
+	enum class Overlap { Outside, Intersecting, Inside };
+
+	Frustum() {}
+
+	explicit Frustum(const Matrix& viewProj) {
+		Vec4 row[4];
+		for (int r = 0; r < 4; r++) row[r] = Vec4(viewProj.m[r * 4], viewProj.m[r * 4 + 1], viewProj.m[r * 4 + 2], viewProj.m[r * 4 + 3]);
+		planes[0] = row[3] + row[0];
+		planes[1] = row[3] - row[0];
+		planes[2] = row[3] + row[1];
+		planes[3] = row[3] - row[1];
+		planes[4] = row[2];
+		planes[5] = row[3] - row[2];
+		for (Vec4& plane : planes) {
+			float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+			if (length > 0.f) plane = plane * (1.f / length);
+		}
+	}
+
+	// Sphere entirely outside one plane
+	bool outside(const Vec3& centre, float radius) const {
+		for (const Vec4& plane : planes) {
+			if (plane.x * centre.x + plane.y * centre.y + plane.z * centre.z + plane.w < -radius) return true;
+		}
+		return false;
+	}
+
+	// Box against the planes in mask (bit i = plane i), planes the box is entirely inside are removed from mask so
+	// the children of a hierarchy skip them
+	Overlap test(const AABB& box, unsigned int& mask) const {
+		for (int i = 0; i < PLANES; i++) {
+			if (!(mask & (1u << i))) continue;
+			const Vec4& plane = planes[i];
+
+			// Box corners furthest along and against the plane normal
+			float far = plane.w, near = plane.w;
+			for (int c = 0; c < 3; c++) {
+				float a = plane.v[c] * box.minimum.v[c], b = plane.v[c] * box.maximum.v[c];
+				far += std::max(a, b);
+				near += std::min(a, b);
+			}
+			if (far < 0.f) return Overlap::Outside;
+			if (near >= 0.f) mask &= ~(1u << i);
+		}
+		return mask == 0 ? Overlap::Inside : Overlap::Intersecting;
+	}
+};
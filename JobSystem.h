@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Completion Counter (counts the jobs added under it that haven't finished yet, a stage that depends on the
+// jobs of another waits for its counter to drop to zero)
+struct JobCounter {
+	std::atomic<int> pending{ 0 };
+
+	bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+// Work-Stealing Job System
+// A persistent pool of worker threads, each with its own deque of jobs. A thread pushes and pops jobs at the
+// back of its own deque (newest first, still hot in its cache) and, when that runs dry, steals from the front
+// of another thread's deque (oldest first, usually the biggest piece of work left). Range jobs split
+// themselves in halves down to their grain, pushing the upper halves for other threads to steal, so a
+// parallelFor spreads over the pool without any central queue. Threads waiting on a counter keep running jobs
+// until it drops to zero, and idle workers park on a condition variable between frames instead of spinning.
+class JobSystem {
+private:
+	// Range job: run(data, begin, end) once the range is no bigger than grain
+	struct Job {
+		void (*run)(void* data, size_t begin, size_t end);
+		void* data;
+		size_t begin, end, grain;
+		JobCounter* counter;
+	};
+
+	// Per-thread deque (the owner uses the back, thieves the front)
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	std::vector<std::unique_ptr<WorkQueue>> queues;	 // [0] is shared by threads outside the pool, [i] belongs to worker i
+	std::vector<std::thread> workers;
+	std::atomic<int> queued{ 0 };			// Jobs sitting in any deque
+	std::atomic<unsigned int> sleeping{ 0 };  // Workers parked (or about to park)
+	std::mutex parkMutex;
+	std::condition_variable park;
+	bool quit = false;
+
+	// Deque of the calling thread (workers of another job system use the shared one)
+	struct ThreadSlot {
+		const JobSystem* owner;
+		size_t index;
+	};
+	static ThreadSlot& threadSlot() {
+		static thread_local ThreadSlot slot = { nullptr, 0 };
+		return slot;
+	}
+	size_t queueIndex() const { return threadSlot().owner == this ? threadSlot().index : 0; }
+
+	template<typename Body>
+	static void invoke(void* data, size_t begin, size_t end) { (*static_cast<Body*>(data))(begin, end); }
+
+	void push(const Job& job) {
+		job.counter->pending.fetch_add(1, std::memory_order_relaxed);
+		WorkQueue& queue = *queues[queueIndex()];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_back(job);
+		}
+		queued.fetch_add(1);
+
+		// Wake a parked worker (taking the lock orders this against a worker that is about to wait)
+		if (sleeping.load() > 0) {
+			{ std::lock_guard<std::mutex> lock(parkMutex); }
+			park.notify_one();
+		}
+	}
+
+	// Take a job from the back of the own deque, or steal one from the front of another
+	bool pop(Job& job) {
+		size_t self = queueIndex();
+		for (size_t i = 0; i < queues.size(); i++) {
+			size_t victim = (self + i) % queues.size();
+			WorkQueue& queue = *queues[victim];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.jobs.empty()) continue;
+			if (victim == self) {
+				job = queue.jobs.back();
+				queue.jobs.pop_back();
+			}
+			else {
+				job = queue.jobs.front();
+				queue.jobs.pop_front();
+			}
+			queued.fetch_sub(1);
+			return true;
+		}
+		return false;
+	}
+
+	void execute(Job job) {
+		// Split off upper halves (whole grains) for other threads until the rest is one grain
+		while (job.end - job.begin > job.grain) {
+			size_t half = ((job.end - job.begin) / 2 + job.grain - 1) / job.grain * job.grain;
+			Job upper = job;
+			upper.begin = job.begin + half;
+			push(upper);
+			job.end = upper.begin;
+		}
+		job.run(job.data, job.begin, job.end);
+		job.counter->pending.fetch_sub(1, std::memory_order_release);
+	}
+
+	void workerLoop(size_t index) {
+		threadSlot() = { this, index };
+		while (true) {
+			Job job;
+			if (pop(job)) {
+				execute(job);
+				continue;
+			}
+
+			// Nothing to do, park until a job is pushed
+			std::unique_lock<std::mutex> lock(parkMutex);
+			sleeping.fetch_add(1);
+			park.wait(lock, [&] { return quit || queued.load() > 0; });
+			sleeping.fetch_sub(1);
+			if (quit) return;
+		}
+	}
+
+public:
+	// Constructor (threadCount includes the threads that wait on jobs, 0 = one per hardware thread)
+	JobSystem(unsigned int threadCount = 0) {
+		if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned int i = 0; i < threadCount; i++) queues.emplace_back(new WorkQueue());
+		for (unsigned int i = 1; i < threadCount; i++) workers.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+
+	~JobSystem() {
+		{
+			std::lock_guard<std::mutex> lock(parkMutex);
+			quit = true;
+		}
+		park.notify_all();
+		for (std::thread& worker : workers) worker.join();
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Queue body(begin, end) over [begin, end) in ranges of about grain, counted by counter (body must stay alive
+	// until the counter is done)
+	template<typename Body>
+	void parallelFor(size_t begin, size_t end, size_t grain, Body& body, JobCounter& counter) {
+		if (begin >= end) return;
+		push({ &JobSystem::invoke<Body>, &body, begin, end, std::max<size_t>(grain, 1), &counter });
+	}
+
+	// Run body(begin, end) over [begin, end) in ranges of about grain and wait for all of them
+	template<typename Body>
+	void parallelFor(size_t begin, size_t end, size_t grain, Body&& body) {
+		JobCounter counter;
+		parallelFor(begin, end, grain, body, counter);
+		wait(counter);
+	}
+
+	// Run jobs until the counter is done
+	void wait(const JobCounter& counter) {
+		while (!counter.done()) {
+			Job job;
+			if (pop(job)) execute(job);
+			else std::this_thread::yield();	 // The last jobs are running on other threads
+		}
+	}
+
+	// Run one queued job if there is any (a thread waiting on something else can help meanwhile)
+	bool runPending() {
+		Job job;
+		if (!pop(job)) return false;
+		execute(job);
+		return true;
+	}
+
+	// Number of threads running jobs (including the ones waiting on them)
+	unsigned int threadCount() const { return static_cast<unsigned int>(queues.size()); }
+};
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "MyMath.h"
+
+// Entries of the FIFO post-transform cache that ACMR is measured against (and Tipsify optimizes for)
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// Triangles an overdraw cluster holds at least before Tipsify's next dead end may start a new one
+const size_t OVERDRAW_CLUSTER_SIZE = 64;
+
+// Merge vertices that are bit-for-bit identical (exporters often write three vertices per triangle), so the vertex
+// stage transforms each of them once and the post-transform cache has something to reuse
+template<typename Vertex>
+static void weldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	// FNV-1a over the vertex bytes, open addressing into a power-of-two table at most half full
+	auto hash = [](const Vertex& v) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&v);
+		uint32_t h = 2166136261u;
+		for (size_t i = 0; i < sizeof(Vertex); i++) h = (h ^ bytes[i]) * 16777619u;
+		return h;
+	};
+	const unsigned int EMPTY = 0xFFFFFFFFu;
+	size_t tableSize = 1;
+	while (tableSize < vertices.size() * 2) tableSize *= 2;
+	std::vector<unsigned int> table(tableSize, EMPTY);
+
+	std::vector<Vertex> unique;
+	std::vector<unsigned int> remap(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		size_t slot = hash(vertices[i]) & (tableSize - 1);
+		while (table[slot] != EMPTY && std::memcmp(&unique[table[slot]], &vertices[i], sizeof(Vertex)) != 0) slot = (slot + 1) & (tableSize - 1);
+		if (table[slot] == EMPTY) {
+			table[slot] = static_cast<unsigned int>(unique.size());
+			unique.push_back(vertices[i]);
+		}
+		remap[i] = table[slot];
+	}
+	for (unsigned int& v : indices) v = remap[v];
+	vertices.swap(unique);
+}
+
+// Average Cache Miss Ratio: vertices a FIFO cache of cacheSize entries has to transform per triangle (0.5 is the
+// ideal for a large regular mesh, 3 means no reuse at all)
+static float computeACMR(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE) {
+	if (indices.size() < 3) return 0.f;
+
+	// A vertex is cached while fewer than cacheSize misses happened since it was last loaded
+	std::vector<size_t> loadedAt(vertexCount, 0);
+	size_t misses = 0;
+	for (unsigned int v : indices) {
+		if (loadedAt[v] == 0 || misses - loadedAt[v] >= cacheSize) loadedAt[v] = ++misses;
+	}
+	return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+// Emits every triangle around a fanning vertex, then continues with the most recently used vertex that still
+// has triangles left and is likely to stay in the cache, or with a dead end from the stack of recently used
+// vertices when none is. clusterStarts gets the first triangle of each run between dead ends (at least
+// OVERDRAW_CLUSTER_SIZE triangles, except for the last), which can be reordered for overdraw without
+// hurting the cache much.
+static void tipsify(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize, std::vector<unsigned int>& out, std::vector<size_t>& clusterStarts) {
+	size_t triangleCount = indices.size() / 3;
+	out.clear();
+	out.reserve(triangleCount * 3);
+	clusterStarts.assign(1, 0);
+	if (triangleCount == 0) return;
+
+	// Triangles around each vertex (offsets into one array) and how many of them are not emitted yet
+	std::vector<unsigned int> live(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++) live[indices[i]]++;
+	std::vector<size_t> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] = offsets[v] + live[v];
+	std::vector<unsigned int> adjacency(offsets[vertexCount]);
+	{
+		std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; i++) adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+	}
+
+	std::vector<size_t> cacheTime(vertexCount, 0);	// Time stamp when each vertex last entered the cache
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<unsigned int> deadEnds;				// Recently used vertices, most recent on top
+	std::vector<unsigned int> candidates;
+	size_t time = cacheSize + 1;
+	size_t cursor = 1;								// Next vertex to try when the dead-end stack runs dry
+	size_t clusterSize = 0;
+
+	long long fanning = 0;
+	while (fanning >= 0) {
+		// Emit the triangles around the fanning vertex that are left
+		candidates.clear();
+		for (size_t a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+			unsigned int t = adjacency[a];
+			if (emitted[t]) continue;
+			for (int k = 0; k < 3; k++) {
+				unsigned int v = indices[t * 3 + k];
+				out.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cacheTime[v] > cacheSize) cacheTime[v] = time++;
+			}
+			emitted[t] = true;
+			clusterSize++;
+		}
+
+		// Next fanning vertex: the one of these in the cache the longest that will still be there after its
+		// remaining triangles are emitted
+		long long next = -1;
+		long long best = -1;
+		for (unsigned int v : candidates) {
+			if (live[v] == 0) continue;
+			long long priority = 0;
+			if (time - cacheTime[v] + 2 * live[v] <= cacheSize) priority = static_cast<long long>(time - cacheTime[v]);
+			if (priority > best) {
+				best = priority;
+				next = v;
+			}
+		}
+
+		// Dead end: most recently used vertex with triangles left, otherwise the next one in input order
+		if (next < 0) {
+			while (!deadEnds.empty() && next < 0) {
+				unsigned int v = deadEnds.back();
+				deadEnds.pop_back();
+				if (live[v] > 0) next = v;
+			}
+			for (; next < 0 && cursor < vertexCount; cursor++) {
+				if (live[cursor] > 0) next = static_cast<long long>(cursor);
+			}
+			if (next >= 0 && clusterSize >= OVERDRAW_CLUSTER_SIZE) {
+				clusterStarts.push_back(out.size() / 3);
+				clusterSize = 0;
+			}
+		}
+		fanning = next;
+	}
+}
+
+// Order clusters of triangles to reduce overdraw from any view: clusters far out from the mesh centre and facing
+// away from it (likely occluders of the rest) are drawn first. The winding is taken from the mesh itself, so
+// it works for both clockwise and counter-clockwise front faces.
+static void sortClustersForOverdraw(std::vector<unsigned int>& indices, const std::vector<size_t>& clusterStarts, const std::vector<Vec3>& positions) {
+	size_t triangleCount = indices.size() / 3;
+	if (clusterStarts.size() < 2) return;
+
+	// Area-weighted centroid of the mesh, and which way the face normals point (signed volume)
+	Vec3 centre(0.f, 0.f, 0.f);
+	float area = 0.f;
+	for (size_t t = 0; t < triangleCount; t++) {
+		const Vec3& p0 = positions[indices[t * 3]];
+		const Vec3& p1 = positions[indices[t * 3 + 1]];
+		const Vec3& p2 = positions[indices[t * 3 + 2]];
+		float a = Cross(p1 - p0, p2 - p0).length();
+		centre += (p0 + p1 + p2) * (a / 3.f);
+		area += a;
+	}
+	if (area > 0.f) centre /= area;
+	float volume = 0.f;
+	for (size_t t = 0; t < triangleCount; t++) {
+		const Vec3& p0 = positions[indices[t * 3]];
+		volume += Dot(p0 - centre, Cross(positions[indices[t * 3 + 1]] - p0, positions[indices[t * 3 + 2]] - p0));
+	}
+	float outward = volume < 0.f ? -1.f : 1.f;
+
+	// Occlusion potential of each cluster: distance of its centroid from the centre along its average normal
+	struct Cluster {
+		size_t first, last;
+		float potential;
+	};
+	std::vector<Cluster> clusters(clusterStarts.size());
+	for (size_t c = 0; c < clusterStarts.size(); c++) {
+		Cluster& cluster = clusters[c];
+		cluster.first = clusterStarts[c];
+		cluster.last = c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : triangleCount;
+
+		Vec3 centroid(0.f, 0.f, 0.f);
+		Vec3 normal(0.f, 0.f, 0.f);
+		for (size_t t = cluster.first; t < cluster.last; t++) {
+			const Vec3& p0 = positions[indices[t * 3]];
+			const Vec3& p1 = positions[indices[t * 3 + 1]];
+			const Vec3& p2 = positions[indices[t * 3 + 2]];
+			centroid += p0 + p1 + p2;
+			normal += Cross(p1 - p0, p2 - p0);  // Area weighted
+		}
+		centroid /= static_cast<float>((cluster.last - cluster.first) * 3);
+		float length = normal.length();
+		cluster.potential = length > 0.f ? Dot(centroid - centre, normal) * (outward / length) : 0.f;
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.potential > b.potential; });
+
+	std::vector<unsigned int> sorted;
+	sorted.reserve(indices.size());
+	for (const Cluster& cluster : clusters)
+		sorted.insert(sorted.end(), indices.begin() + cluster.first * 3, indices.begin() + cluster.last * 3);
+	indices.swap(sorted);
+}
+
+// Renumber vertices in the order the triangles first use them (vertex fetch then walks memory forwards), returns
+// the new index of every old vertex. Unused vertices go to the end.
+static std::vector<unsigned int> optimizeVertexFetch(std::vector<unsigned int>& indices, size_t vertexCount) {
+	const unsigned int UNUSED = 0xFFFFFFFFu;
+	std::vector<unsigned int> remap(vertexCount, UNUSED);
+	unsigned int next = 0;
+	for (unsigned int& v : indices) {
+		if (remap[v] == UNUSED) remap[v] = next++;
+		v = remap[v];
+	}
+	for (unsigned int& r : remap) {
+		if (r == UNUSED) r = next++;
+	}
+	return remap;
+}
+
+// Load-Time Mesh Optimization
+// Welds duplicate vertices, reorders the triangles for the post-transform cache (Tipsify), sorts Tipsify's clusters to reduce overdraw,
+// then reorders the vertices (anything with a GEMVec3-like position member) for fetch locality. Indices that
+// reference missing vertices leave the mesh untouched.
+template<typename Vertex>
+static void optimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	indices.resize(indices.size() / 3 * 3);
+	for (unsigned int v : indices) {
+		if (v >= vertices.size()) return;
+	}
+
+	weldVertices(vertices, indices);
+
+	std::vector<unsigned int> reordered;
+	std::vector<size_t> clusterStarts;
+	tipsify(indices, vertices.size(), VERTEX_CACHE_SIZE, reordered, clusterStarts);
+
+	std::vector<Vec3> positions(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) positions[i] = Vec3(vertices[i].position.x, vertices[i].position.y, vertices[i].position.z);
+	sortClustersForOverdraw(reordered, clusterStarts, positions);
+
+	std::vector<unsigned int> remap = optimizeVertexFetch(reordered, vertices.size());
+	std::vector<Vertex> remapped(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) remapped[remap[i]] = vertices[i];
+	vertices.swap(remapped);
+	indices.swap(reordered);
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "Frustum.h"
+#include "MyMath.h"
+#include "PrimitiveAssembly.h"
+
+// Limits of one cluster (a vertex list of 64 fits local corners in a byte, 124 triangles keep most clusters full)
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+// How much a triangle whose normal leaves the cluster's average normal costs against one that adds a new vertex
+// while growing a cluster (higher = narrower normal cones, more clusters culled, slightly more vertices)
+const float MESHLET_CONE_WEIGHT = 4.f;
+
+// Meshlet (cluster of neighbouring triangles with its own vertex list, culled as a whole before any of its
+// vertices is transformed)
+struct Meshlet {
+	unsigned int firstVertex, vertexCount;		// Range of the cluster vertex list
+	unsigned int firstTriangle, triangleCount;	// Range of the cluster triangles (three local corners each)
+	Vec3 centre;								// Bounding sphere of the vertices
+	float radius;
+	Vec3 coneAxis;								// Normal cone around the average face normal
+	float coneSin;								// Sine of its half angle (1 = too wide to cull)
+};
+
+// Bounding sphere and normal cone of a finished cluster
+static void finishMeshlet(const std::vector<Vec3>& positions, const std::vector<unsigned int>& meshletVertices, const std::vector<unsigned char>& meshletTriangles, Meshlet& m) {
+	Vec3 minimum = positions[meshletVertices[m.firstVertex]], maximum = minimum;
+	for (unsigned int i = 0; i < m.vertexCount; i++) {
+		const Vec3& p = positions[meshletVertices[m.firstVertex + i]];
+		minimum = Vec3(std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z));
+		maximum = Vec3(std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z));
+	}
+	m.centre = (minimum + maximum) * 0.5f;
+	m.radius = 0.f;
+	for (unsigned int i = 0; i < m.vertexCount; i++) m.radius = std::max(m.radius, (positions[meshletVertices[m.firstVertex + i]] - m.centre).length());
+
+	// Axis = average face normal, the cone opens as far as the normal furthest from it
+	std::vector<Vec3> normals;
+	Vec3 sum(0.f, 0.f, 0.f);
+	for (unsigned int t = 0; t < m.triangleCount; t++) {
+		const unsigned char* c = &meshletTriangles[(m.firstTriangle + t) * 3];
+		const Vec3& p0 = positions[meshletVertices[m.firstVertex + c[0]]];
+		Vec3 n = Cross(positions[meshletVertices[m.firstVertex + c[1]]] - p0, positions[meshletVertices[m.firstVertex + c[2]]] - p0);
+		float length = n.length();
+		if (length == 0.f) continue;  // Degenerate, never rasterized
+		normals.push_back(n / length);
+		sum += normals.back();
+	}
+	m.coneAxis = Vec3(0.f, 0.f, 0.f);
+	m.coneSin = 1.f;
+	float length = sum.length();
+	if (normals.empty() || length < 1e-6f) return;
+	m.coneAxis = sum / length;
+	float minDot = 1.f;
+	for (const Vec3& n : normals) minDot = std::min(minDot, Dot(n, m.coneAxis));
+	if (minDot > 0.f) m.coneSin = std::sqrt(std::max(0.f, 1.f - minDot * minDot));
+}
+
+// Split an indexed mesh into meshlets. Each cluster starts at the first triangle (in index order) not taken yet and
+// grows over triangles that share a vertex with it, preferring the ones that add no new vertex and whose normal
+// stays close to the cluster's average normal, so clusters come out compact with narrow normal cones. When no
+// neighbour is left (a hard edge, a separate piece) the cluster carries on with the nearest free triangle close to
+// it in Morton order, as long as that stays within half the cluster's extent of its bounds. Every cluster gets a
+// list of the mesh vertices it uses (a vertex shared by two clusters is listed in both) and local corners for its
+// triangles.
+static void buildMeshlets(const std::vector<Vec3>& positions, const std::vector<unsigned int>& indices, std::vector<Meshlet>& meshlets,
+						  std::vector<unsigned int>& meshletVertices, std::vector<unsigned char>& meshletTriangles) {
+	meshlets.clear();
+	meshletVertices.clear();
+	meshletTriangles.clear();
+	size_t triangleCount = indices.size() / 3;
+	size_t vertexCount = positions.size();
+
+	// Triangles around each vertex (offsets into one array) and unit face normals (zero when degenerate)
+	std::vector<size_t> offsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++) offsets[indices[i] + 1]++;
+	for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+	std::vector<unsigned int> adjacency(offsets[vertexCount]);
+	{
+		std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; i++) adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+	}
+	std::vector<Vec3> faceNormals(triangleCount), centroids(triangleCount);
+	AABB meshBounds;
+	for (size_t t = 0; t < triangleCount; t++) {
+		const Vec3& p0 = positions[indices[t * 3]];
+		const Vec3& p1 = positions[indices[t * 3 + 1]];
+		const Vec3& p2 = positions[indices[t * 3 + 2]];
+		Vec3 n = Cross(p1 - p0, p2 - p0);
+		float length = n.length();
+		faceNormals[t] = length > 0.f ? n / length : Vec3(0.f, 0.f, 0.f);
+		centroids[t] = (p0 + p1 + p2) / 3.f;
+		meshBounds.extend(centroids[t]);
+	}
+
+	// Triangles sorted by the Morton code of their centroid (10 bits per axis), and each triangle's place in that order
+	std::vector<unsigned int> spatial(triangleCount), spatialRank(triangleCount);
+	{
+		auto spread = [](unsigned int v) {
+			v = (v | (v << 16)) & 0x030000FFu;
+			v = (v | (v << 8)) & 0x0300F00Fu;
+			v = (v | (v << 4)) & 0x030C30C3u;
+			return (v | (v << 2)) & 0x09249249u;
+		};
+		Vec3 extent = meshBounds.maximum - meshBounds.minimum;
+		std::vector<unsigned int> codes(triangleCount);
+		for (size_t t = 0; t < triangleCount; t++) {
+			unsigned int q[3];
+			for (int axis = 0; axis < 3; axis++) {
+				float f = extent.v[axis] > 0.f ? (centroids[t].v[axis] - meshBounds.minimum.v[axis]) / extent.v[axis] : 0.f;
+				q[axis] = static_cast<unsigned int>(std::min(std::max(f, 0.f), 1.f) * 1023.f);
+			}
+			codes[t] = spread(q[0]) | (spread(q[1]) << 1) | (spread(q[2]) << 2);
+			spatial[t] = static_cast<unsigned int>(t);
+		}
+		std::stable_sort(spatial.begin(), spatial.end(), [&](unsigned int a, unsigned int b) { return codes[a] < codes[b]; });
+		for (size_t r = 0; r < triangleCount; r++) spatialRank[spatial[r]] = static_cast<unsigned int>(r);
+	}
+
+	const unsigned char UNUSED = 0xFF;
+	std::vector<unsigned char> local(vertexCount, UNUSED);					  // Local index of each mesh vertex in the open cluster
+	std::vector<bool> taken(triangleCount, false);
+	std::vector<size_t> candidateOf(triangleCount, ~static_cast<size_t>(0));  // Cluster a triangle was last a candidate of
+	std::vector<unsigned int> candidates;
+
+	for (size_t seed = 0; seed < triangleCount; seed++) {
+		if (taken[seed]) continue;
+
+		Meshlet m = {};
+		m.firstVertex = static_cast<unsigned int>(meshletVertices.size());
+		m.firstTriangle = static_cast<unsigned int>(meshletTriangles.size() / 3);
+		size_t cluster = meshlets.size();
+		Vec3 normalSum(0.f, 0.f, 0.f);
+		AABB clusterBounds;
+		candidates.clear();
+
+		unsigned int next = static_cast<unsigned int>(seed);
+		while (true) {
+			// Take the triangle, its vertices and the triangles around new vertices as candidates
+			taken[next] = true;
+			normalSum += faceNormals[next];
+			for (int k = 0; k < 3; k++) {
+				unsigned int v = indices[next * 3 + k];
+				if (local[v] == UNUSED) {
+					local[v] = static_cast<unsigned char>(m.vertexCount++);
+					meshletVertices.push_back(v);
+					clusterBounds.extend(positions[v]);
+					for (size_t a = offsets[v]; a < offsets[v + 1]; a++) {
+						unsigned int t = adjacency[a];
+						if (!taken[t] && candidateOf[t] != cluster) {
+							candidateOf[t] = cluster;
+							candidates.push_back(t);
+						}
+					}
+				}
+				meshletTriangles.push_back(local[v]);
+			}
+			if (++m.triangleCount == MESHLET_MAX_TRIANGLES) break;
+
+			// Cheapest candidate that still fits
+			float axisLength = normalSum.length();
+			Vec3 axis = axisLength > 0.f ? normalSum / axisLength : Vec3(0.f, 0.f, 0.f);
+			float bestScore = FLT_MAX;
+			size_t best = candidates.size();
+			for (size_t c = 0; c < candidates.size(); c++) {
+				unsigned int t = candidates[c];
+				if (taken[t]) continue;
+				unsigned int newVertices = 0;
+				for (int k = 0; k < 3; k++) newVertices += local[indices[t * 3 + k]] == UNUSED;
+				if (m.vertexCount + newVertices > MESHLET_MAX_VERTICES) continue;
+				float score = newVertices + MESHLET_CONE_WEIGHT * (1.f - Dot(faceNormals[t], axis));
+				if (score < bestScore) {
+					bestScore = score;
+					best = c;
+				}
+			}
+			if (best < candidates.size()) {
+				next = candidates[best];
+				candidates[best] = candidates.back();
+				candidates.pop_back();
+				continue;
+			}
+
+			// No neighbour fits, nearest free triangle among the Morton neighbours of the last one taken
+			Vec3 centre = clusterBounds.centre(), reach = (clusterBounds.maximum - clusterBounds.minimum) * 0.5f;
+			float bestDistance = FLT_MAX;
+			size_t rank = spatialRank[next];
+			size_t first = rank > MESHLET_MAX_TRIANGLES ? rank - MESHLET_MAX_TRIANGLES : 0, last = std::min(triangleCount, rank + MESHLET_MAX_TRIANGLES + 1);
+			for (size_t r = first; r < last; r++) {
+				unsigned int t = spatial[r];
+				if (taken[t]) continue;
+				const Vec3& c = centroids[t];
+				bool nearby = true;
+				for (int axis = 0; axis < 3; axis++) {
+					nearby = nearby && c.v[axis] >= clusterBounds.minimum.v[axis] - reach.v[axis] && c.v[axis] <= clusterBounds.maximum.v[axis] + reach.v[axis];
+				}
+				if (!nearby) continue;
+				unsigned int newVertices = 0;
+				for (int k = 0; k < 3; k++) newVertices += local[indices[t * 3 + k]] == UNUSED;
+				if (m.vertexCount + newVertices > MESHLET_MAX_VERTICES) continue;
+				float distance = (c - centre).lengthSquare();
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					next = t;
+				}
+			}
+			if (bestDistance == FLT_MAX) break;
+		}
+
+		for (unsigned int v = 0; v < m.vertexCount; v++) local[meshletVertices[m.firstVertex + v]] = UNUSED;
+		finishMeshlet(positions, meshletVertices, meshletTriangles, m);
+		meshlets.push_back(m);
+	}
+}
+
+// Meshlet Culling
+// Rejects whole clusters whose bounding sphere is outside one plane of the view frustum, or whose normal cone
+// shows every triangle faces the culled side from the eye. Both are conservative: every triangle of a
+// rejected cluster would be dropped by the primitive assembler's frustum or face test.
+class MeshletCuller {
+private:
+	Frustum frustum;	// Object space
+	Vec3 eye;			// Object space
+	float facing;		// Sign that makes culled-side geometric normals point away from the eye (0 = no face culling)
+
+public:
+	// Constructor (viewProj maps object space to clip space, eye is the camera position in object space)
+	MeshletCuller(const Matrix& viewProj, const Vec3& _eye, CullMode cullMode, FrontFace frontFace = FrontFace::Clockwise) : frustum(viewProj), eye(_eye) {
+		// With the y-down viewport, triangles that are clockwise on screen have geometric normals
+		// (cross(p1 - p0, p2 - p0)) pointing towards the eye
+		bool culledClockwise = (cullMode == CullMode::Back) != (frontFace == FrontFace::Clockwise);
+		facing = cullMode == CullMode::None ? 0.f : (culledClockwise ? -1.f : 1.f);
+	}
+
+	// Bounding sphere entirely outside one plane
+	bool outsideFrustum(const Meshlet& m) const { return frustum.outside(m.centre, m.radius); }
+
+	// Every triangle faces the culled side from anywhere in the bounding sphere
+	bool culledSide(const Meshlet& m) const {
+		if (facing == 0.f || m.coneSin >= 1.f) return false;
+		Vec3 view = m.centre - eye;
+		return facing * Dot(view, m.coneAxis) > m.coneSin * view.length() + m.radius * (1.f + m.coneSin);
+	}
+};
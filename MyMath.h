@@ -7,7 +7,14 @@
 #include <cmath>
 #include <iostream>
 
-#include "GamesEngineeringBase.h"
+#include "RenderTarget.h"
+
+// SSE backend for Vec4, Matrix and Colour on x86 (define MYMATH_SCALAR before including to build the scalar reference).
+// Both backends do the same operations in the same order, so they produce identical results.
+#if !defined(MYMATH_SCALAR) && (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#define MYMATH_SSE 1
+#include <emmintrin.h>
+#endif
 
 // Vec3 Class
 class Vec3 {
@@ -107,15 +114,49 @@ public:
 	union {
 		float v[4];
 		struct { float x, y, z, w; };
+#ifdef MYMATH_SSE
+		__m128 simd;  // Also makes the class 16-byte aligned
+#endif
 	};
 
 	// Constructors
+#ifdef MYMATH_SSE
+	// Built in a register, writing the lanes one at a time would stall the next 16-byte load
+	Vec4() : simd(_mm_setr_ps(0.f, 0.f, 0.f, 1.f)) {}
+	Vec4(float _x, float _y) : simd(_mm_setr_ps(_x, _y, 0.f, 1.f)) {}
+	Vec4(float _x, float _y, float _z) : simd(_mm_setr_ps(_x, _y, _z, 1.f)) {}
+	Vec4(float _x, float _y, float _z, float _w) : simd(_mm_setr_ps(_x, _y, _z, _w)) {}
+	explicit Vec4(__m128 _simd) : simd(_simd) {}
+#else
 	Vec4() : x(0.f), y(0.f), z(0.f), w(1.f) {}
 	Vec4(float _x, float _y) : x(_x), y(_y), z(0.f), w(1.f) {}
 	Vec4(float _x, float _y, float _z) : x(_x), y(_y), z(_z), w(1.f) {}
 	Vec4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+#endif
 
 	// Vec4 Operator Overloading
+#ifdef MYMATH_SSE
+	Vec4 operator+(const Vec4& pVec) const { return Vec4(_mm_add_ps(simd, pVec.simd)); }
+	Vec4 operator-(const Vec4& pVec) const { return Vec4(_mm_sub_ps(simd, pVec.simd)); }
+	Vec4 operator*(const Vec4& pVec) const { return Vec4(_mm_mul_ps(simd, pVec.simd)); }
+	Vec4 operator/(const Vec4& pVec) const { return Vec4(_mm_div_ps(simd, pVec.simd)); }
+
+	Vec4 operator*(const float scalar) const { return Vec4(_mm_mul_ps(simd, _mm_set1_ps(scalar))); }
+	Vec4 operator/(const float scalar) const { return Vec4(_mm_div_ps(simd, _mm_set1_ps(scalar))); }
+
+	// Vec4& Operator Overloading
+	Vec4& operator+=(const Vec4& pVec) { simd = _mm_add_ps(simd, pVec.simd); return *this; }
+	Vec4& operator-=(const Vec4& pVec) { simd = _mm_sub_ps(simd, pVec.simd); return *this; }
+	Vec4& operator*=(const Vec4& pVec) { simd = _mm_mul_ps(simd, pVec.simd); return *this; }
+	Vec4& operator/=(const Vec4& pVec) { simd = _mm_div_ps(simd, pVec.simd); return *this; }
+	Vec4& operator*=(const float scalar) { simd = _mm_mul_ps(simd, _mm_set1_ps(scalar)); return *this; }
+	Vec4& operator/=(const float scalar) { simd = _mm_div_ps(simd, _mm_set1_ps(scalar)); return *this; }
+
+	float& operator[](int index) { return v[index]; }
+
+	// Unary Negate (flips the sign bits, like the scalar negate)
+	Vec4 operator-() const { return Vec4(_mm_xor_ps(simd, _mm_set1_ps(-0.f))); }
+#else
 	Vec4 operator+(const Vec4& pVec) const { return Vec4(v[0] + pVec.v[0], v[1] + pVec.v[1], v[2] + pVec.v[2], v[3] + pVec.v[3]); }
 	Vec4 operator-(const Vec4& pVec) const { return Vec4(v[0] - pVec.v[0], v[1] - pVec.v[1], v[2] - pVec.v[2], v[3] - pVec.v[3]); }
 	Vec4 operator*(const Vec4& pVec) const { return Vec4(v[0] * pVec.v[0], v[1] * pVec.v[1], v[2] * pVec.v[2], v[3] * pVec.v[3]); }
@@ -159,6 +200,7 @@ public:
 
 	// Unary Negate
 	Vec4 operator-() const { return Vec4(-v[0], -v[1], -v[2], -v[3]); }
+#endif
 
 	// Methods
 	// Length (magnitude) of a vector
@@ -168,7 +210,7 @@ public:
 	// Normalize a vector (i.e. unit vector)
 	Vec4 normalize() {
 		float len = 1.f / sqrt(SQ(v[0]) + SQ(v[1]) + SQ(v[2]) + SQ(v[3]));
-		return Vec4(v[0] * len, v[1] * len, v[2] * len, v[3] * len);
+		return *this * len;
 	}
 
 	float normalizeAndGetLength() {
@@ -191,13 +233,24 @@ public:
 	// Divide by w
 	Vec4 divideByW() {
 		float W = 1.f / v[3];
+#ifdef MYMATH_SSE
+		__m128 scaled = _mm_mul_ps(simd, _mm_set1_ps(W));
+		return Vec4(_mm_shuffle_ps(scaled, _mm_unpackhi_ps(scaled, _mm_set1_ps(W)), _MM_SHUFFLE(1, 0, 1, 0)));  // x, y, z scaled, w = W
+#else
 		return Vec4(v[0] * W, v[1] * W, v[2] * W, W);
+#endif
 	}
 };
 
 float Dot(const Vec4& v1, const Vec4& v2) { return (v1.v[0] * v2.v[0] + v1.v[1] * v2.v[1] + v1.v[2] * v2.v[2] + v1.v[3] * v2.v[3]); }
+#ifdef MYMATH_SSE
+// Operands swapped so NaN and signed zero pick the same side as std::max / std::min
+Vec4 Max(const Vec4& v1, const Vec4& v2) { return Vec4(_mm_max_ps(v2.simd, v1.simd)); }
+Vec4 Min(const Vec4& v1, const Vec4& v2) { return Vec4(_mm_min_ps(v2.simd, v1.simd)); }
+#else
 Vec4 Max(const Vec4& v1, const Vec4& v2) { return Vec4(std::max(v1.v[0], v2.v[0]), std::max(v1.v[1], v2.v[1]), std::max(v1.v[2], v2.v[2]), std::max(v1.v[3], v2.v[3])); }
 Vec4 Min(const Vec4& v1, const Vec4& v2) { return Vec4(std::min(v1.v[0], v2.v[0]), std::min(v1.v[1], v2.v[1]), std::min(v1.v[2], v2.v[2]), std::min(v1.v[3], v2.v[3])); }
+#endif
 
 // 4x4 Matrix Class
 class Matrix {
@@ -206,6 +259,9 @@ public:
 	union {
 		float a[4][4];
 		float m[16];
+#ifdef MYMATH_SSE
+		__m128 rows[4];
+#endif
 	};
 
 	// Constructors
@@ -236,10 +292,19 @@ public:
 
 	// Matrix & Vector Multiplication
 	Vec4 mul(const Vec4& v) {
+#ifdef MYMATH_SSE
+		// Sum of the columns scaled by the components (per lane the same sum as the row dot products)
+		__m128 c0 = rows[0], c1 = rows[1], c2 = rows[2], c3 = rows[3];
+		_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+		__m128 x = _mm_shuffle_ps(v.simd, v.simd, _MM_SHUFFLE(0, 0, 0, 0)), y = _mm_shuffle_ps(v.simd, v.simd, _MM_SHUFFLE(1, 1, 1, 1));
+		__m128 z = _mm_shuffle_ps(v.simd, v.simd, _MM_SHUFFLE(2, 2, 2, 2)), w = _mm_shuffle_ps(v.simd, v.simd, _MM_SHUFFLE(3, 3, 3, 3));
+		return Vec4(_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, c0), _mm_mul_ps(y, c1)), _mm_mul_ps(z, c2)), _mm_mul_ps(w, c3)));
+#else
 		return Vec4((v.x * m[0] + v.y * m[1] + v.z * m[2] + v.w * m[3]),
 					(v.x * m[4] + v.y * m[5] + v.z * m[6] + v.w * m[7]),
 					(v.x * m[8] + v.y * m[9] + v.z * m[10] + v.w * m[11]),
 					(v.x * m[12] + v.y * m[13] + v.z * m[14] + v.w * m[15]));
+#endif
 	}
 
 	Vec3 mulPoint(const Vec3& v) {
@@ -259,6 +324,13 @@ public:
 	// 4x4 Matrix Multiplication
 	Matrix mul(const Matrix& matrix) const {
 		Matrix ret;
+#ifdef MYMATH_SSE
+		// Each row of the result is this row's entries times the rows of matrix
+		for (int i = 0; i < 4; i++)
+			ret.rows[i] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[i * 4]), matrix.rows[0]), _mm_mul_ps(_mm_set1_ps(m[i * 4 + 1]), matrix.rows[1])),
+												_mm_mul_ps(_mm_set1_ps(m[i * 4 + 2]), matrix.rows[2])), _mm_mul_ps(_mm_set1_ps(m[i * 4 + 3]), matrix.rows[3]));
+		return ret;
+#else
 		ret.m[0] = m[0] * matrix.m[0] + m[1] * matrix.m[4] + m[2] * matrix.m[8] + m[3] * matrix.m[12];
 		ret.m[1] = m[0] * matrix.m[1] + m[1] * matrix.m[5] + m[2] * matrix.m[9] + m[3] * matrix.m[13];
 		ret.m[2] = m[0] * matrix.m[2] + m[1] * matrix.m[6] + m[2] * matrix.m[10] + m[3] * matrix.m[14];
@@ -276,6 +348,7 @@ public:
 		ret.m[14] = m[12] * matrix.m[2] + m[13] * matrix.m[6] + m[14] * matrix.m[10] + m[15] * matrix.m[14];
 		ret.m[15] = m[12] * matrix.m[3] + m[13] * matrix.m[7] + m[14] * matrix.m[11] + m[15] * matrix.m[15];
 		return ret;
+#endif
 	}
 
 	// Rotate on x-axis
@@ -373,10 +446,10 @@ public:
 		return inv;
 	}
 
-	// Projection Matrix
-	static Matrix projection(GamesEngineeringBase::Window& canvas, float zFar, float zNear, float fovTheta = 90.f) {
+	// Projection Matrix (z maps near to 0 and far to 1, or the other way round for a reversed-Z target)
+	static Matrix projection(const RenderTarget& target, float zFar, float zNear, float fovTheta = 90.f) {
 		// Calculate FOV (Field of View) and Aspect Ratio
-		float aspect = static_cast<float>(canvas.getWidth()) / canvas.getHeight();
+		float aspect = static_cast<float>(target.getWidth()) / target.getHeight();
 		float fov = tan((fovTheta * (M_PI / 180.f)) / 2.f);
 		
 		// Initialize Projection Matrix
@@ -387,8 +460,14 @@ public:
 		proj[5] = 1 / fov;
 
 		// Z mapping
-		proj[10] = (zFar / (zFar - zNear));
-		proj[11] = -(zFar * zNear) / (zFar - zNear);
+		if (target.getDepthFormat() == DepthFormat::ReversedFloat32) {
+			proj[10] = -zNear / (zFar - zNear);
+			proj[11] = (zFar * zNear) / (zFar - zNear);
+		}
+		else {
+			proj[10] = (zFar / (zFar - zNear));
+			proj[11] = -(zFar * zNear) / (zFar - zNear);
+		}
 
 		// Set w component
 		proj[14] = 1.f;
@@ -416,6 +495,170 @@ public:
 	}
 };
 
+// Affine Transform Class (3x4, rows of [R | t], the fourth row is always 0 0 0 1)
+// Object and view transforms never need the projective row, so composing two costs 36 multiplies instead of 64
+// and the inverse is a 3x3 adjugate instead of a 4x4 cofactor expansion. The inverse of R is cached on first
+// use, it gives both inverse() and the normal matrix (inverse-transpose of R).
+class Transform {
+private:
+	float m[12];
+	mutable float inv[9];				// Inverse of R (row-major), valid when inverseCached
+	mutable bool inverseCached = false;
+
+	// Inverse of the 3x3 part by its adjugate (identity if it is singular)
+	void cacheInverse() const {
+		if (inverseCached) return;
+		inverseCached = true;
+		float c0 = m[5] * m[10] - m[6] * m[9];
+		float c1 = m[6] * m[8] - m[4] * m[10];
+		float c2 = m[4] * m[9] - m[5] * m[8];
+		float det = m[0] * c0 + m[1] * c1 + m[2] * c2;
+		if (det == 0.f) {
+			for (int i = 0; i < 9; i++) inv[i] = (i % 4 == 0) ? 1.f : 0.f;
+			return;
+		}
+		float invDet = 1.f / det;
+		inv[0] = c0 * invDet; inv[1] = (m[2] * m[9] - m[1] * m[10]) * invDet; inv[2] = (m[1] * m[6] - m[2] * m[5]) * invDet;
+		inv[3] = c1 * invDet; inv[4] = (m[0] * m[10] - m[2] * m[8]) * invDet; inv[5] = (m[2] * m[4] - m[0] * m[6]) * invDet;
+		inv[6] = c2 * invDet; inv[7] = (m[1] * m[8] - m[0] * m[9]) * invDet; inv[8] = (m[0] * m[5] - m[1] * m[4]) * invDet;
+	}
+
+public:
+	// Constructors
+	Transform() {
+		// Initialize to identity
+		for (int i = 0; i < 12; i++) m[i] = (i % 5 == 0) ? 1.f : 0.f;
+	}
+
+	Transform(float f1, float f2, float f3, float f4, float f5, float f6, float f7, float f8, float f9, float f10, float f11, float f12) {
+		m[0] = f1; m[1] = f2; m[2] = f3; m[3] = f4;
+		m[4] = f5; m[5] = f6; m[6] = f7; m[7] = f8;
+		m[8] = f9; m[9] = f10; m[10] = f11; m[11] = f12;
+	}
+
+	// From the top three rows of a row-major 4x4 matrix (e.g. GEMInstance::w.m), the bottom row is assumed to be 0 0 0 1
+	explicit Transform(const float* rowMajor4x4) { for (int i = 0; i < 12; i++) m[i] = rowMajor4x4[i]; }
+	explicit Transform(const Matrix& matrix) : Transform(matrix.m) {}
+
+	// Operator Overloading
+	float operator[](const int index) const { return m[index]; }
+	Transform operator*(const Transform& transform) const { return mul(transform); }
+
+	// Methods
+	// Composition (this * transform, i.e. transform is applied first)
+	Transform mul(const Transform& t) const {
+		Transform ret;
+		for (int r = 0; r < 3; r++) {
+			const float* row = &m[r * 4];
+			ret.m[r * 4] = row[0] * t.m[0] + row[1] * t.m[4] + row[2] * t.m[8];
+			ret.m[r * 4 + 1] = row[0] * t.m[1] + row[1] * t.m[5] + row[2] * t.m[9];
+			ret.m[r * 4 + 2] = row[0] * t.m[2] + row[1] * t.m[6] + row[2] * t.m[10];
+			ret.m[r * 4 + 3] = row[0] * t.m[3] + row[1] * t.m[7] + row[2] * t.m[11] + row[3];
+		}
+		return ret;
+	}
+
+	// Point (w = 1) and Direction (w = 0) Transforms
+	Vec3 mulPoint(const Vec3& v) const {
+		return Vec3((v.x * m[0] + v.y * m[1] + v.z * m[2]) + m[3],
+					(v.x * m[4] + v.y * m[5] + v.z * m[6]) + m[7],
+					(v.x * m[8] + v.y * m[9] + v.z * m[10]) + m[11]);
+	}
+
+	Vec3 mulVec(const Vec3& v) const {
+		return Vec3((v.x * m[0] + v.y * m[1] + v.z * m[2]),
+					(v.x * m[4] + v.y * m[5] + v.z * m[6]),
+					(v.x * m[8] + v.y * m[9] + v.z * m[10]));
+	}
+
+	// Normal Transform (by the inverse-transpose of R, not normalized)
+	Vec3 mulNormal(const Vec3& n) const {
+		cacheInverse();
+		return Vec3((n.x * inv[0] + n.y * inv[3] + n.z * inv[6]),
+					(n.x * inv[1] + n.y * inv[4] + n.z * inv[7]),
+					(n.x * inv[2] + n.y * inv[5] + n.z * inv[8]));
+	}
+
+	// Normal Matrix (inverse-transpose of R, row-major 3x3)
+	void normalMatrix(float out[9]) const {
+		cacheInverse();
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++) out[r * 3 + c] = inv[c * 3 + r];
+	}
+
+	// Inverse ([R^-1 | -R^-1 t], identity if R is singular)
+	Transform inverse() const {
+		cacheInverse();
+		return Transform(inv[0], inv[1], inv[2], -(inv[0] * m[3] + inv[1] * m[7] + inv[2] * m[11]),
+						 inv[3], inv[4], inv[5], -(inv[3] * m[3] + inv[4] * m[7] + inv[5] * m[11]),
+						 inv[6], inv[7], inv[8], -(inv[6] * m[3] + inv[7] * m[7] + inv[8] * m[11]));
+	}
+
+	// Exactly the identity (e.g. an instance placed without a transform)
+	bool isIdentity() const {
+		for (int i = 0; i < 12; i++) {
+			if (m[i] != ((i % 5 == 0) ? 1.f : 0.f)) return false;
+		}
+		return true;
+	}
+
+	// Determinant of the 3x3 part (negative when the transform mirrors, which flips the winding of triangles)
+	float determinant() const {
+		return m[0] * (m[5] * m[10] - m[6] * m[9]) + m[1] * (m[6] * m[8] - m[4] * m[10]) + m[2] * (m[4] * m[9] - m[5] * m[8]);
+	}
+
+	// Full 4x4 Matrix
+	Matrix toMatrix() const {
+		return Matrix(m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8], m[9], m[10], m[11], 0.f, 0.f, 0.f, 1.f);
+	}
+
+	// Translate
+	static Transform translate(const Vec3& t) { return Transform(1.f, 0.f, 0.f, t.x, 0.f, 1.f, 0.f, t.y, 0.f, 0.f, 1.f, t.z); }
+
+	// Scale
+	static Transform scale(const Vec3& s) { return Transform(s.x, 0.f, 0.f, 0.f, 0.f, s.y, 0.f, 0.f, 0.f, 0.f, s.z, 0.f); }
+	static Transform scale(const float s) { return scale(Vec3(s, s, s)); }
+
+	// Rotate on x, y and z-axis
+	static Transform rotateOnXAxis(const float theta) {
+		float c = cos(theta), s = sin(theta);
+		return Transform(1.f, 0.f, 0.f, 0.f, 0.f, c, -s, 0.f, 0.f, s, c, 0.f);
+	}
+
+	static Transform rotateOnYAxis(const float theta) {
+		float c = cos(theta), s = sin(theta);
+		return Transform(c, 0.f, s, 0.f, 0.f, 1.f, 0.f, 0.f, -s, 0.f, c, 0.f);
+	}
+
+	static Transform rotateOnZAxis(const float theta) {
+		float c = cos(theta), s = sin(theta);
+		return Transform(c, -s, 0.f, 0.f, s, c, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f);
+	}
+
+	// LookAt (same basis as Matrix::lookAt, R is orthonormal so the inverse is exact)
+	static Transform lookAt(const Vec3& from, const Vec3& to, const Vec3& up) {
+		Vec3 dir = (to - from).normalize();
+		Vec3 right = Cross(up, dir);
+		Vec3 up1 = Cross(dir, right);
+		return Transform(right.x, right.y, right.z, Dot(-from, right),
+						 up1.x, up1.y, up1.z, Dot(-from, up1),
+						 dir.x, dir.y, dir.z, Dot(-from, dir));
+	}
+};
+
+// Projective Matrix times Affine Transform (skips the products with the implicit 0 0 0 1 row)
+Matrix operator*(const Matrix& matrix, const Transform& t) {
+	Matrix ret;
+	for (int r = 0; r < 4; r++) {
+		const float* row = &matrix.m[r * 4];
+		ret.m[r * 4] = row[0] * t[0] + row[1] * t[4] + row[2] * t[8];
+		ret.m[r * 4 + 1] = row[0] * t[1] + row[1] * t[5] + row[2] * t[9];
+		ret.m[r * 4 + 2] = row[0] * t[2] + row[1] * t[6] + row[2] * t[10];
+		ret.m[r * 4 + 3] = row[0] * t[3] + row[1] * t[7] + row[2] * t[11] + row[3];
+	}
+	return ret;
+}
+
 // Spherical Coordinate Class
 class SphericalCoordinate {
 public:
@@ -569,32 +812,93 @@ public:
 	union {
 		float c[4];
 		struct { float r, g, b, a; };
+#ifdef MYMATH_SSE
+		__m128 simd;
+#endif
 	};
 
 	// Constructors
+#ifdef MYMATH_SSE
+	Colour() : simd(_mm_setzero_ps()) {}
+	Colour(float _r, float _g, float _b) : simd(_mm_setr_ps(_r, _g, _b, 1.f)) {}
+	Colour(float _r, float _g, float _b, float _a) : simd(_mm_setr_ps(_r, _g, _b, _a)) {}
+#else
 	Colour() : r(0.f), g(0.f), b(0.f), a(0.f) {}
 	Colour(float _r, float _g, float _b) : r(_r), g(_g), b(_b), a(1.f) {}
 	Colour(float _r, float _g, float _b, float _a) : r(_r), g(_g), b(_b), a(_a) {}
+#endif
 	Colour(unsigned char _r, unsigned char _g, unsigned char _b) : r(_r / 255.f), g(_g / 255.f), b(_b / 255.f), a(1.f) {}
 	Colour(unsigned char _r, unsigned char _g, unsigned char _b, unsigned char _a) : r(_r / 255.f), g(_g / 255.f), b(_b / 255.f), a(_a) {}
+#ifdef MYMATH_SSE
+	explicit Colour(__m128 _simd) : simd(_simd) {}
+#endif
 
 	// Operator Overloading
+#ifdef MYMATH_SSE
+	Colour operator+(const Colour& colour) const { return Colour(_mm_add_ps(simd, colour.simd)); }
+	Colour operator-(const Colour& colour) const { return Colour(_mm_sub_ps(simd, colour.simd)); }
+	Colour operator*(const Colour& colour) const { return Colour(_mm_mul_ps(simd, colour.simd)); }
+	Colour operator*(const float scalar) const { return Colour(_mm_mul_ps(simd, _mm_set1_ps(scalar))); }
+	Colour operator/(const Colour& colour) const { return Colour(_mm_div_ps(simd, colour.simd)); }
+	Colour operator/(const float scalar) const { return Colour(_mm_div_ps(simd, _mm_set1_ps(scalar))); }
+#else
 	Colour operator+(const Colour& colour) const { return Colour(r + colour.r, g + colour.g, b + colour.b, a + colour.a); }
 	Colour operator-(const Colour& colour) const { return Colour(r - colour.r, g - colour.g, b - colour.b, a - colour.a); }
 	Colour operator*(const Colour& colour) const { return Colour(r * colour.r, g * colour.g, b * colour.b, a * colour.a); }
 	Colour operator*(const float scalar) const { return Colour(r * scalar, g * scalar, b * scalar, a * scalar); }
 	Colour operator/(const Colour& colour) const { return Colour(r / colour.r, g / colour.g, b / colour.b, a / colour.a); }
 	Colour operator/(const float scalar) const { return Colour(r / scalar, g / scalar, b / scalar, a / scalar); }
+#endif
+
+	// Methods
+	// One channel to 0..255 (scaled by 255 and truncated, out of range and NaN saturate)
+	static unsigned int toUnorm8(float channel) {
+		float scaled = channel * 255.f;
+		return scaled >= 255.f ? 255u : (scaled > 0.f ? static_cast<unsigned int>(scaled) : 0u);
+	}
+
+#ifdef MYMATH_SSE
+	// Four channels to 0..255, as toUnorm8 (clamped before the conversion, which would turn overflow into INT_MIN,
+	// max takes its second operand for NaN)
+	static __m128i toUnorm8(__m128 channels) {
+		__m128 scaled = _mm_mul_ps(channels, _mm_set1_ps(255.f));
+		return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(scaled, _mm_setzero_ps()), _mm_set1_ps(255.f)));
+	}
+#endif
+
+	// Packed RGBA8 pixel (r in the lowest byte, so the bytes in memory are r, g, b, a)
+#ifdef MYMATH_SSE
+	unsigned int toRGBA8() const {
+		__m128i channels = toUnorm8(simd);
+		channels = _mm_packs_epi32(channels, channels);
+		return static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_packus_epi16(channels, channels)));
+	}
+#else
+	unsigned int toRGBA8() const { return toUnorm8(r) | (toUnorm8(g) << 8) | (toUnorm8(b) << 16) | (toUnorm8(a) << 24); }
+#endif
 };
 
+// Pack count colours to RGBA8 pixels (same conversion as Colour::toRGBA8, four pixels per step under SSE)
+void packRGBA8(const Colour* colours, unsigned int* out, int count) {
+	int i = 0;
+#ifdef MYMATH_SSE
+	for (; i + 4 <= count; i += 4) {
+		__m128i p0 = Colour::toUnorm8(colours[i].simd);
+		__m128i p1 = Colour::toUnorm8(colours[i + 1].simd);
+		__m128i p2 = Colour::toUnorm8(colours[i + 2].simd);
+		__m128i p3 = Colour::toUnorm8(colours[i + 3].simd);
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+	}
+#endif
+	for (; i < count; i++) out[i] = colours[i].toRGBA8();
+}
+
 // Triangle Class
 class Triangle {
 public:
-	// Union elements can be accessed in the same memory address, unlike structs
-	union {
-		Vec4 v[3];
-		struct { Vec4 v0, v1, v2; };
-	};
+	// Plain members (an anonymous struct of Vec4s inside a union only compiles as an MSVC extension)
+	Vec4 v0, v1, v2;
 
 	// Constructor
 	Triangle(const Vec4& _v0, const Vec4& _v1, const Vec4& _v2) : v0(_v0), v1(_v1), v2(_v2) {}
@@ -603,13 +907,19 @@ public:
 // Edge Function
 float edgeFunction(const Vec4& v0, const Vec4& v1, const Vec4& p) { return (((p.x - v0.x) * (v1.y - v0.y)) - ((v1.x - v0.x) * (p.y - v0.y))); }
 
+// Find Bounds (clamped to a pixel rectangle, e.g. a screen tile)
+void findBounds(const PixelRect& clip, const Vec4& v0, const Vec4& v1, const Vec4& v2, Vec4& tr, Vec4& bl)
+{
+	tr.x = std::min(std::max(std::max(v0.x, v1.x), v2.x), static_cast<float>(clip.maxX));
+	tr.y = std::min(std::max(std::max(v0.y, v1.y), v2.y), static_cast<float>(clip.maxY));
+	bl.x = std::max(std::min(std::min(v0.x, v1.x), v2.x), static_cast<float>(clip.minX));
+	bl.y = std::max(std::min(std::min(v0.y, v1.y), v2.y), static_cast<float>(clip.minY));
+}
+
 // Find Bounds
-void findBounds(GamesEngineeringBase::Window& canvas, const Vec4& v0, const Vec4& v1, const Vec4& v2, Vec4& tr, Vec4& bl)
+void findBounds(const RenderTarget& target, const Vec4& v0, const Vec4& v1, const Vec4& v2, Vec4& tr, Vec4& bl)
 {
-	tr.x = std::min(std::max(std::max(v0.x, v1.x), v2.x), canvas.getWidth() - 1 / 1.f);
-	tr.y = std::min(std::max(std::max(v0.y, v1.y), v2.y), canvas.getHeight() - 1 / 1.f);
-	bl.x = std::max(std::min(std::min(v0.x, v1.x), v2.x), 0.f);
-	bl.y = std::max(std::min(std::min(v0.y, v1.y), v2.y), 0.f);
+	findBounds(target.getBounds(), v0, v1, v2, tr, bl);
 }
 
 // Simple Interpolate Function
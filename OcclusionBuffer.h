@@ -0,0 +1,359 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "MyMath.h"
+#include "PrimitiveAssembly.h"
+#include "RasterKernel.h"
+#include "VertexStage.h"
+
+// Largest occlusion buffer (smaller targets get one pixel per target pixel, so an occlusion pixel is never smaller
+// than a target pixel)
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 128;
+
+// Rows per occluder rasterization job
+const int OCCLUSION_BAND_HEIGHT = 16;
+
+// Slack (in occlusion pixels) that silhouette edges are widened by, triangle overlap reaches out by and tested
+// rectangles grow by, far more than the main rasterizer's sub-pixel snapping can move an edge
+const float OCCLUSION_MARGIN = 0.125f;
+
+// Triangle across each edge of an indexed mesh (edge k of triangle t runs from corner k to corner k + 1, its
+// neighbour is neighbours[t * 3 + k]). Vertices are matched by position, and an edge only has a neighbour when
+// exactly two triangles share it and run along it in opposite directions, -1 otherwise (open, non-manifold or
+// inconsistently wound).
+static void buildEdgeNeighbours(const VertexStreams& positions, const std::vector<unsigned int>& indices, std::vector<int>& neighbours) {
+	size_t triangleCount = indices.size() / 3;
+	neighbours.assign(triangleCount * 3, -1);
+
+	// One id per distinct position (the first vertex with it)
+	std::vector<unsigned int> byPosition(positions.size());
+	for (size_t v = 0; v < byPosition.size(); v++) byPosition[v] = static_cast<unsigned int>(v);
+	auto key = [&](unsigned int v) {
+		uint32_t bits[3];
+		std::memcpy(&bits[0], &positions.x[v], 4);
+		std::memcpy(&bits[1], &positions.y[v], 4);
+		std::memcpy(&bits[2], &positions.z[v], 4);
+		return std::make_pair(std::make_pair(bits[0], bits[1]), bits[2]);
+	};
+	std::sort(byPosition.begin(), byPosition.end(), [&](unsigned int a, unsigned int b) { return key(a) < key(b); });
+	std::vector<unsigned int> positionId(positions.size());
+	for (size_t i = 0; i < byPosition.size(); i++) {
+		positionId[byPosition[i]] = (i > 0 && key(byPosition[i]) == key(byPosition[i - 1])) ? positionId[byPosition[i - 1]] : byPosition[i];
+	}
+
+	// Edges sorted by their (unordered) pair of position ids
+	struct Edge {
+		uint64_t pair;
+		unsigned int corner;	// Triangle * 3 + edge
+		bool forward;			// Runs from the lower id to the higher one
+	};
+	std::vector<Edge> edges;
+	edges.reserve(triangleCount * 3);
+	for (size_t t = 0; t < triangleCount; t++) {
+		for (int k = 0; k < 3; k++) {
+			unsigned int a = positionId[indices[t * 3 + k]], b = positionId[indices[t * 3 + (k + 1) % 3]];
+			if (a == b) continue;  // Collapsed, left open
+			uint64_t pair = (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+			edges.push_back({ pair, static_cast<unsigned int>(t * 3 + k), a < b });
+		}
+	}
+	std::sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) { return a.pair < b.pair; });
+	for (size_t i = 0; i < edges.size();) {
+		size_t j = i + 1;
+		while (j < edges.size() && edges[j].pair == edges[i].pair) j++;
+		if (j - i == 2 && edges[i].forward != edges[i + 1].forward) {
+			neighbours[edges[i].corner] = static_cast<int>(edges[i + 1].corner / 3);
+			neighbours[edges[i + 1].corner] = static_cast<int>(edges[i].corner / 3);
+		}
+		i = j;
+	}
+}
+
+// Software Occlusion Buffer
+// A low-resolution buffer of 1/w (linear in screen space whatever the depth format, 0 = nothing, larger = nearer).
+// Each occluder is rasterized four pixels at a time on its own before it is merged, and a pixel only takes part
+// when the occluder covers all of it: the pixel centre is inside one of its triangles and none of the occluder's
+// outline edges (edges of kept triangles whose neighbour across is missing, culled or wound the other way on
+// screen, the only edges the outline of the covered area can run along) passes through the pixel. Its value is
+// the smallest 1/w that any triangle overlapping the pixel takes over it, so neither the coverage nor the depth
+// ever claims more than the occluder hides, whatever the triangle sizes. A box is hidden when every pixel its
+// screen rectangle touches holds a value strictly nearer than its nearest corner. Occluder triangles outside the
+// near or far plane, and boxes reaching behind the eye, never take part.
+class OcclusionBuffer {
+private:
+	// Screen-space occluder triangle: edge functions a * x + b * y + c at the top-left corner of pixel (x, y),
+	// centre[] >= 0 when the pixel centre is inside, overlap[] >= 0 when some of the pixel (grown by the margin) is,
+	// and the smallest 1/w over the pixel as a plane clamped to the farthest vertex
+	struct OccluderTriangle {
+		float a[3], b[3], centre[3], overlap[3];
+		float dzdx, dzdy, z0, farthest;
+		int minX, minY, maxX, maxY;	// Pixels the triangle can overlap
+	};
+
+	// Outline edge in occlusion buffer pixels
+	struct OutlineEdge {
+		float x0, y0, x1, y1;
+	};
+
+	// Triangles and outline edges of one occluder
+	struct Occluder {
+		size_t firstTriangle, lastTriangle;
+		size_t firstEdge, lastEdge;
+	};
+
+	int width = 0, height = 0;
+	int stride = 0;							// Row length, a multiple of the 4 pixels one step covers
+	std::vector<float> depth;
+	std::vector<OccluderTriangle> triangles;
+	std::vector<OutlineEdge> outline;
+	std::vector<Occluder> occluders;
+	TransformedVertices transformed;		// Occluder vertices in occlusion buffer pixels
+	std::vector<signed char> winding;		// Per occluder triangle: screen winding (+1 clockwise, -1) or 0 when not kept
+
+	// Rasterize every occluder into rows [y0, y1) (at most one band)
+	void rasterizeRows(int y0, int y1) {
+		float bound[OCCLUSION_BAND_HEIGHT * OCCLUSION_WIDTH];	// Smallest 1/w of the triangles overlapping each pixel
+		float covered[OCCLUSION_BAND_HEIGHT * OCCLUSION_WIDTH];	// Pixel centre inside (all bits set) or not (0)
+		size_t bandSize = static_cast<size_t>(y1 - y0) * stride;
+		for (const Occluder& o : occluders) {
+			std::fill(bound, bound + bandSize, FLT_MAX);
+			std::fill(covered, covered + bandSize, 0.f);
+
+			for (size_t i = o.firstTriangle; i < o.lastTriangle; i++) {
+				const OccluderTriangle& t = triangles[i];
+				int minY = std::max(t.minY, y0), maxY = std::min(t.maxY, y1 - 1);
+				for (int y = minY; y <= maxY; y++) {
+					float* boundRow = &bound[static_cast<size_t>(y - y0) * stride];
+					float* coveredRow = &covered[static_cast<size_t>(y - y0) * stride];
+					int x = t.minX & ~3;
+#ifdef RASTER_X86
+					// Lanes left of the triangle fail the edge tests, lanes right of the target land in the row padding
+					__m128 fx = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), _mm_setr_ps(0.f, 1.f, 2.f, 3.f)), fy = _mm_set1_ps(static_cast<float>(y)), zero = _mm_setzero_ps();
+					__m128 centre[3], overlap[3], step[3];
+					for (int k = 0; k < 3; k++) {
+						__m128 e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[k]), fx), _mm_mul_ps(_mm_set1_ps(t.b[k]), fy));
+						centre[k] = _mm_add_ps(e, _mm_set1_ps(t.centre[k]));
+						overlap[k] = _mm_add_ps(e, _mm_set1_ps(t.overlap[k]));
+						step[k] = _mm_set1_ps(t.a[k] * 4.f);
+					}
+					__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.dzdx), fx), _mm_mul_ps(_mm_set1_ps(t.dzdy), fy)), _mm_set1_ps(t.z0));
+					__m128 zStep = _mm_set1_ps(t.dzdx * 4.f), farthest = _mm_set1_ps(t.farthest), none = _mm_set1_ps(FLT_MAX);
+					for (; x <= t.maxX; x += 4) {
+						__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(centre[0], zero), _mm_cmpge_ps(centre[1], zero)), _mm_cmpge_ps(centre[2], zero));
+						__m128 touches = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(overlap[0], zero), _mm_cmpge_ps(overlap[1], zero)), _mm_cmpge_ps(overlap[2], zero));
+						__m128 value = _mm_or_ps(_mm_and_ps(touches, _mm_max_ps(z, farthest)), _mm_andnot_ps(touches, none));
+						_mm_storeu_ps(boundRow + x, _mm_min_ps(_mm_loadu_ps(boundRow + x), value));
+						_mm_storeu_ps(coveredRow + x, _mm_or_ps(_mm_loadu_ps(coveredRow + x), inside));
+						for (int k = 0; k < 3; k++) {
+							centre[k] = _mm_add_ps(centre[k], step[k]);
+							overlap[k] = _mm_add_ps(overlap[k], step[k]);
+						}
+						z = _mm_add_ps(z, zStep);
+					}
+#else
+					for (; x <= t.maxX; x++) {
+						float fx = static_cast<float>(x), fy = static_cast<float>(y);
+						bool inside = true, touches = true;
+						for (int k = 0; k < 3; k++) {
+							float e = t.a[k] * fx + t.b[k] * fy;
+							inside = inside && e + t.centre[k] >= 0.f;
+							touches = touches && e + t.overlap[k] >= 0.f;
+						}
+						if (touches) boundRow[x] = std::min(boundRow[x], std::max(t.dzdx * fx + t.dzdy * fy + t.z0, t.farthest));
+						if (inside) coveredRow[x] = 1.f;
+					}
+#endif
+				}
+			}
+
+			// Pixels an outline edge passes through (widened by the margin) are only partly covered
+			for (size_t i = o.firstEdge; i < o.lastEdge; i++) {
+				const OutlineEdge& e = outline[i];
+				float top = std::min(e.y0, e.y1) - OCCLUSION_MARGIN, bottom = std::max(e.y0, e.y1) + OCCLUSION_MARGIN;
+				int minY = std::max(y0, static_cast<int>(std::floor(std::max(top, static_cast<float>(y0))))), maxY = std::min(y1 - 1, static_cast<int>(std::floor(std::min(bottom, static_cast<float>(y1)))));
+				for (int y = minY; y <= maxY; y++) {
+					// Part of the edge inside the row (grown by the margin)
+					float rowTop = y - OCCLUSION_MARGIN, rowBottom = y + 1.f + OCCLUSION_MARGIN;
+					float left = std::min(e.x0, e.x1), right = std::max(e.x0, e.x1);
+					float dy = e.y1 - e.y0;
+					if (dy != 0.f) {
+						float s0 = std::min(std::max((rowTop - e.y0) / dy, 0.f), 1.f), s1 = std::min(std::max((rowBottom - e.y0) / dy, 0.f), 1.f);
+						float xa = e.x0 + (e.x1 - e.x0) * s0, xb = e.x0 + (e.x1 - e.x0) * s1;
+						left = std::min(xa, xb);
+						right = std::max(xa, xb);
+					}
+					left = std::max(left - OCCLUSION_MARGIN, 0.f);
+					right = std::min(right + OCCLUSION_MARGIN, width - 1.f);
+					if (!(left <= right)) continue;
+					float* coveredRow = &covered[static_cast<size_t>(y - y0) * stride];
+					std::fill(coveredRow + static_cast<int>(left), coveredRow + static_cast<int>(right) + 1, 0.f);
+				}
+			}
+
+			// Merge the pixels the occluder covers entirely
+			for (size_t i = 0; i < bandSize; i++) {
+				if (covered[i] != 0.f && bound[i] != FLT_MAX) {
+					float& d = depth[static_cast<size_t>(y0) * stride + i];
+					d = std::max(d, bound[i]);
+				}
+			}
+		}
+	}
+
+public:
+	// Start a frame (the buffer matches the target's aspect only through the projection, like any viewport)
+	void begin(int targetWidth, int targetHeight) {
+		width = std::min(OCCLUSION_WIDTH, targetWidth);
+		height = std::min(OCCLUSION_HEIGHT, targetHeight);
+		stride = (width + 3) & ~3;
+		depth.assign(static_cast<size_t>(stride) * height, 0.f);
+		triangles.clear();
+		outline.clear();
+		occluders.clear();
+	}
+
+	// Set up an occluder mesh (mvp maps its model space to clip space, neighbours as from buildEdgeNeighbours): the
+	// triangles primitive assembly would not cull for their facing, and the outline edges around them
+	void addOccluder(const VertexStreams& positions, const std::vector<unsigned int>& indices, const std::vector<int>& neighbours, const Matrix& mvp, CullMode cullMode, FrontFace frontFace = FrontFace::Clockwise) {
+		VertexStage(mvp, static_cast<float>(width), static_cast<float>(height)).transform(positions, transformed);
+		const Vec4* clip = transformed.clip.data();
+		const Vec4* screen = transformed.screen.data();
+		size_t triangleCount = indices.size() / 3;
+		Occluder o = { triangles.size(), triangles.size(), outline.size(), outline.size() };
+
+		// Kept triangles and their winding
+		winding.assign(triangleCount, 0);
+		for (size_t i = 0; i < triangleCount; i++) {
+			const Vec4* v[3] = { &screen[indices[i * 3]], &screen[indices[i * 3 + 1]], &screen[indices[i * 3 + 2]] };
+
+			// Entirely between the near and far planes (0 <= z <= w, with either depth direction)
+			bool between = true;
+			for (int k = 0; k < 3; k++) {
+				const Vec4& c = clip[indices[i * 3 + k]];
+				between = between && c.w > 0.f && c.z >= 0.f && c.z <= c.w;
+			}
+			if (!between) continue;
+
+			// Twice the signed area, > 0 = clockwise on screen (as in primitive assembly)
+			float area = (v[1]->x - v[0]->x) * (v[2]->y - v[0]->y) - (v[2]->x - v[0]->x) * (v[1]->y - v[0]->y);
+			if (!(std::fabs(area) > 0.f)) continue;  // Degenerate (or NaN)
+			if (cullMode != CullMode::None) {
+				bool front = (area > 0.f) == (frontFace == FrontFace::Clockwise);
+				if (front == (cullMode == CullMode::Front)) continue;
+			}
+			winding[i] = area > 0.f ? 1 : -1;
+
+			OccluderTriangle t;
+			float minX = std::min(std::min(v[0]->x, v[1]->x), v[2]->x), maxX = std::max(std::max(v[0]->x, v[1]->x), v[2]->x);
+			float minY = std::min(std::min(v[0]->y, v[1]->y), v[2]->y), maxY = std::max(std::max(v[0]->y, v[1]->y), v[2]->y);
+			t.minX = static_cast<int>(std::floor(std::max(0.f, minX - OCCLUSION_MARGIN)));
+			t.minY = static_cast<int>(std::floor(std::max(0.f, minY - OCCLUSION_MARGIN)));
+			t.maxX = static_cast<int>(std::floor(std::min(width - 1.f, maxX + OCCLUSION_MARGIN)));
+			t.maxY = static_cast<int>(std::floor(std::min(height - 1.f, maxY + OCCLUSION_MARGIN)));
+			if (t.minX > t.maxX || t.minY > t.maxY) continue;  // Off the buffer
+
+			// Edges i -> j, positive inside, taken at the pixel centre and at the pixel corner where they are largest
+			float sign = area > 0.f ? 1.f : -1.f;
+			for (int k = 0; k < 3; k++) {
+				const Vec4& p = *v[k];
+				const Vec4& q = *v[(k + 1) % 3];
+				float a = -(q.y - p.y) * sign, b = (q.x - p.x) * sign;
+				float c = -(a * p.x + b * p.y);
+				t.a[k] = a;
+				t.b[k] = b;
+				t.centre[k] = c + 0.5f * (a + b);
+				t.overlap[k] = c + std::max(a, 0.f) + std::max(b, 0.f) + OCCLUSION_MARGIN * (std::fabs(a) + std::fabs(b));
+			}
+
+			// 1/w plane (screen w holds 1/w) taken at the pixel corner where it is smallest (farthest), and the
+			// farthest vertex, a bound the plane can undercut outside the triangle but never inside it
+			float inverseArea = 1.f / area;
+			float dz1 = v[1]->w - v[0]->w, dz2 = v[2]->w - v[0]->w;
+			float dx1 = v[1]->x - v[0]->x, dx2 = v[2]->x - v[0]->x;
+			float dy1 = v[1]->y - v[0]->y, dy2 = v[2]->y - v[0]->y;
+			t.dzdx = (dz1 * dy2 - dz2 * dy1) * inverseArea;
+			t.dzdy = (dz2 * dx1 - dz1 * dx2) * inverseArea;
+			t.z0 = v[0]->w - t.dzdx * v[0]->x - t.dzdy * v[0]->y + std::min(t.dzdx, 0.f) + std::min(t.dzdy, 0.f);
+			t.farthest = std::min(std::min(v[0]->w, v[1]->w), v[2]->w);
+			triangles.push_back(t);
+		}
+
+		// Outline: edges of kept triangles where the covered area can end (each shared edge is added by both sides
+		// when both count it, which only widens the outline)
+		for (size_t i = 0; i < triangleCount; i++) {
+			if (winding[i] == 0) continue;
+			for (int k = 0; k < 3; k++) {
+				int n = neighbours[i * 3 + k];
+				if (n >= 0 && winding[n] == winding[i]) continue;
+				const Vec4& p = screen[indices[i * 3 + k]];
+				const Vec4& q = screen[indices[i * 3 + (k + 1) % 3]];
+				if (std::max(p.x, q.x) < -OCCLUSION_MARGIN || std::min(p.x, q.x) > width + OCCLUSION_MARGIN) continue;  // Off the buffer
+				if (std::max(p.y, q.y) < -OCCLUSION_MARGIN || std::min(p.y, q.y) > height + OCCLUSION_MARGIN) continue;
+				outline.push_back({ p.x, p.y, q.x, q.y });
+			}
+		}
+
+		o.lastTriangle = triangles.size();
+		o.lastEdge = outline.size();
+		if (o.lastTriangle > o.firstTriangle) occluders.push_back(o);
+		else outline.resize(o.firstEdge);
+	}
+
+	// Rasterize the occluders added since begin(), bands of rows run as jobs
+	void rasterize(JobSystem& jobs) {
+		if (occluders.empty()) return;
+		size_t bands = (height + OCCLUSION_BAND_HEIGHT - 1) / OCCLUSION_BAND_HEIGHT;
+		jobs.parallelFor(0, bands, 1, [&](size_t begin, size_t end) {
+			for (size_t band = begin; band < end; band++) {
+				rasterizeRows(static_cast<int>(band) * OCCLUSION_BAND_HEIGHT, std::min(height, static_cast<int>(band + 1) * OCCLUSION_BAND_HEIGHT));
+			}
+		});
+	}
+
+	// Occluder triangles in the buffer
+	size_t occluderTriangles() const { return triangles.size(); }
+
+	// Every point of the box (mvp maps its space to clip space) is behind an occluder
+	bool occluded(const AABB& box, const Matrix& mvp) const {
+		if (triangles.empty() || box.empty()) return false;
+
+		// Screen rectangle and nearest 1/w of the corners (w is affine, so a corner is the nearest point)
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = 0.f;
+		for (int corner = 0; corner < 8; corner++) {
+			float px = (corner & 1) ? box.maximum.x : box.minimum.x;
+			float py = (corner & 2) ? box.maximum.y : box.minimum.y;
+			float pz = (corner & 4) ? box.maximum.z : box.minimum.z;
+			float c[4];
+			for (int r = 0; r < 4; r++) c[r] = px * mvp.m[r * 4] + py * mvp.m[r * 4 + 1] + pz * mvp.m[r * 4 + 2] + mvp.m[r * 4 + 3];
+			if (!(c[3] > 0.f)) return false;  // Reaches behind the eye (or NaN)
+			float W = 1.f / c[3];
+			float x = (c[0] * W + 1.0f) * 0.5f * width;
+			float y = (1.f - (c[1] * W + 1.0f) * 0.5f) * height;
+			minX = std::min(minX, x); maxX = std::max(maxX, x);
+			minY = std::min(minY, y); maxY = std::max(maxY, y);
+			nearest = std::max(nearest, W);
+		}
+
+		if (!(maxX >= 0.f && maxY >= 0.f && minX < width && minY < height)) return false;  // Off the buffer (or NaN), left to frustum culling
+		int x0 = static_cast<int>(std::floor(std::max(0.f, minX - OCCLUSION_MARGIN)));
+		int y0 = static_cast<int>(std::floor(std::max(0.f, minY - OCCLUSION_MARGIN)));
+		int x1 = static_cast<int>(std::floor(std::min(width - 1.f, maxX + OCCLUSION_MARGIN)));
+		int y1 = static_cast<int>(std::floor(std::min(height - 1.f, maxY + OCCLUSION_MARGIN)));
+		for (int y = y0; y <= y1; y++) {
+			const float* row = &depth[static_cast<size_t>(y) * stride];
+			for (int x = x0; x <= x1; x++) {
+				if (!(row[x] > nearest)) return false;
+			}
+		}
+		return true;
+	}
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+
+#include "Clipper.h"
+#include "MyMath.h"
+#include "RasterKernel.h"
+#include "RenderTarget.h"
+
+// Which side of a triangle gets culled
+enum class CullMode { None, Back, Front };
+
+// Screen winding of front faces (as seen on screen, y pointing down)
+enum class FrontFace { Clockwise, CounterClockwise };
+
+// Primitive Assembly Counters (triangles removed by each test, in the order they run)
+struct PrimitiveStats {
+	unsigned long long submitted = 0;	  // Triangles handed to assemble()
+	unsigned long long frustum = 0;		  // Entirely outside one plane of the view frustum
+	unsigned long long clipped = 0;		  // Crossed the near plane or guard band and went through the clipper
+	unsigned long long degenerate = 0;	  // Zero area once snapped to the sub-pixel grid (or not a number)
+	unsigned long long backface = 0;	  // Facing the culled side
+	unsigned long long subPixel = 0;	  // Bounding box contains no pixel centre
+	unsigned long long rasterized = 0;	  // Triangles emitted to the rasterizer (clipped ones can emit several)
+	unsigned long long clusters = 0;	  // Meshlets tested before their triangles reach assemble()
+	unsigned long long clusterFrustum = 0;	// Meshlets whose bounding sphere is outside the frustum
+	unsigned long long clusterBackface = 0; // Meshlets whose normal cone faces the culled side
+	unsigned long long clusterOccluded = 0; // Meshlets whose bounds are hidden in the occlusion buffer
+
+	void reset() { *this = PrimitiveStats(); }
+
+	// Add the counters of another assembler (e.g. one per binning job)
+	PrimitiveStats& operator+=(const PrimitiveStats& other) {
+		submitted += other.submitted; frustum += other.frustum; clipped += other.clipped; degenerate += other.degenerate;
+		backface += other.backface; subPixel += other.subPixel; rasterized += other.rasterized;
+		clusters += other.clusters; clusterFrustum += other.clusterFrustum; clusterBackface += other.clusterBackface; clusterOccluded += other.clusterOccluded;
+		return *this;
+	}
+
+	// One line summary, scaled by 1 / frames
+	void print(std::ostream& out, int frames = 1) const {
+		out << "Primitives per frame: " << submitted / frames << " submitted, " << frustum / frames << " frustum, "
+			<< degenerate / frames << " degenerate, " << backface / frames << " backface, " << subPixel / frames << " sub-pixel culled, "
+			<< clipped / frames << " clipped, " << rasterized / frames << " rasterized" << std::endl;
+		if (clusters > 0) {
+			out << "Meshlets per frame: " << clusters / frames << " tested, " << clusterFrustum / frames << " frustum, "
+				<< clusterBackface / frames << " backface, " << clusterOccluded / frames << " occluded culled" << std::endl;
+		}
+	}
+};
+
+// Primitive Assembly
+// Runs between the vertex transform and the rasterizer. Each clip-space triangle is
+//   1. dropped if all three vertices are outside the same frustum plane,
+//   2. clipped against the near plane and guard band (Clipper) if it crosses them,
+//   3. projected to the screen and snapped to the rasterizer's sub-pixel grid, then dropped if it has zero
+//      snapped area, faces the culled side, or its bounds fall between pixel centres.
+// Survivors are handed to emit(t, a, b, c) as a screen-space triangle plus the clip vertices it came from
+// (their weights rebuild the vertex attributes).
+class PrimitiveAssembler {
+private:
+	const RenderTarget& target;
+	Clipper clipper;
+	CullMode cullMode;
+	FrontFace frontFace;
+	PrimitiveStats& stats;
+
+	// Viewport transform (NDC -> pixels, y down), w becomes 1/w for perspective-correct interpolation
+	Vec4 toScreen(Vec4 clip) const {
+		Vec4 v = clip.divideByW();
+		float screenX = (v[0] + 1.0f) * 0.5f * target.getWidth();
+		float screenY = (1.f - (v[1] + 1.0f) * 0.5f) * target.getHeight();
+		return Vec4(screenX, screenY, v[2], v[3]);
+	}
+
+	// Floor division for the sub-pixel test (coordinates can be negative inside the guard band)
+	static int64_t floorDiv(int64_t a, int64_t b) { return (a >= 0) ? a / b : -((-a + b - 1) / b); }
+
+	// Screen-space tests on a triangle that survived clipping
+	template<typename Emit>
+	void assembleScreen(const Triangle& t, const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, Emit& emit) {
+		// Snap exactly like TriangleSetup so the decisions match what the rasterizer would see
+		const Vec4* v[3] = { &t.v0, &t.v1, &t.v2 };
+		int64_t fx[3], fy[3];
+		for (int i = 0; i < 3; i++) {
+			if (!(std::fabs(v[i]->x) < FIXED_POINT_LIMIT && std::fabs(v[i]->y) < FIXED_POINT_LIMIT)) {	// NaN
+				stats.degenerate++;
+				return;
+			}
+			fx[i] = roundToFixed(v[i]->x);
+			fy[i] = roundToFixed(v[i]->y);
+		}
+
+		// Twice the signed area, > 0 = clockwise on screen
+		int64_t area = (fx[1] - fx[0]) * (fy[2] - fy[0]) - (fx[2] - fx[0]) * (fy[1] - fy[0]);
+		if (area == 0) {
+			stats.degenerate++;
+			return;
+		}
+		if (cullMode != CullMode::None) {
+			bool front = (area > 0) == (frontFace == FrontFace::Clockwise);
+			if (front == (cullMode == CullMode::Front)) {
+				stats.backface++;
+				return;
+			}
+		}
+
+		// Pixel centres sit at i * SUBPIXEL_ONE + SUBPIXEL_HALF, cull if no column or no row of them is inside the bounds
+		int64_t minFx = std::min(std::min(fx[0], fx[1]), fx[2]), maxFx = std::max(std::max(fx[0], fx[1]), fx[2]);
+		int64_t minFy = std::min(std::min(fy[0], fy[1]), fy[2]), maxFy = std::max(std::max(fy[0], fy[1]), fy[2]);
+		if (floorDiv(maxFx - SUBPIXEL_HALF, SUBPIXEL_ONE) * SUBPIXEL_ONE + SUBPIXEL_HALF < minFx ||
+			floorDiv(maxFy - SUBPIXEL_HALF, SUBPIXEL_ONE) * SUBPIXEL_ONE + SUBPIXEL_HALF < minFy) {
+			stats.subPixel++;
+			return;
+		}
+
+		stats.rasterized++;
+		emit(t, a, b, c);
+	}
+
+public:
+	// Constructor (stats are accumulated, never reset here)
+	PrimitiveAssembler(const RenderTarget& _target, PrimitiveStats& _stats, CullMode _cullMode = CullMode::Back, FrontFace _frontFace = FrontFace::Clockwise)
+		: target(_target), clipper(_target), cullMode(_cullMode), frontFace(_frontFace), stats(_stats) {}
+
+	// Assemble one clip-space triangle
+	template<typename Emit>
+	void assemble(const Vec4& c0, const Vec4& c1, const Vec4& c2, Emit&& emit) {
+		assemble(c0, c1, c2, toScreen(c0), toScreen(c1), toScreen(c2), emit);
+	}
+
+	// Assemble one clip-space triangle whose corners the vertex stage already projected (s0, s1, s2 = toScreen(c0, c1, c2)),
+	// only triangles that have to be clipped project their new corners here
+	template<typename Emit>
+	void assemble(const Vec4& c0, const Vec4& c1, const Vec4& c2, const Vec4& s0, const Vec4& s1, const Vec4& s2, Emit&& emit) {
+		stats.submitted++;
+
+		// View frustum (0 <= z <= w, -w <= x, y <= w), all three vertices outside the same plane
+		auto outcode = [](const Vec4& p) {
+			return (p.x > p.w ? 1 : 0) | (p.x < -p.w ? 2 : 0) | (p.y > p.w ? 4 : 0) | (p.y < -p.w ? 8 : 0) | (p.z < 0.f ? 16 : 0) | (p.z > p.w ? 32 : 0);
+		};
+		if (outcode(c0) & outcode(c1) & outcode(c2)) {
+			stats.frustum++;
+			return;
+		}
+
+		// Inside the near plane and guard band, nothing to clip
+		if ((clipper.outcode(c0) | clipper.outcode(c1) | clipper.outcode(c2)) == 0) {
+			ClipVertex a = { c0, Vec4(1.f, 0.f, 0.f, 0.f) };
+			ClipVertex b = { c1, Vec4(0.f, 1.f, 0.f, 0.f) };
+			ClipVertex c = { c2, Vec4(0.f, 0.f, 1.f, 0.f) };
+			assembleScreen(Triangle(s0, s1, s2), a, b, c, emit);
+			return;
+		}
+
+		bool clipped = clipper.clipTriangle(c0, c1, c2, [&](const ClipVertex& a, const ClipVertex& b, const ClipVertex& c) {
+			assembleScreen(Triangle(toScreen(a.position), toScreen(b.position), toScreen(c.position)), a, b, c, emit);
+		});
+		if (clipped) stats.clipped++;
+	}
+};
@@ -0,0 +1,489 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "MyMath.h"
+#include "RenderTarget.h"
+
+// x86 builds get the SSE and AVX2 kernels, everything else runs the scalar reference
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RASTER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC emits any intrinsic without flags, GCC and Clang need the instruction set enabled per function
+#if defined(RASTER_X86) && !defined(_MSC_VER)
+#define RASTER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RASTER_TARGET_AVX2
+#endif
+
+// Raster Kernel Selection
+enum class RasterKernelType { Scalar, SSE, AVX2 };
+
+// Sub-pixel precision of the snapped vertex positions (4 bits = 1/16 pixel)
+const int SUBPIXEL_BITS = 4;
+const int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+const int SUBPIXEL_HALF = SUBPIXEL_ONE / 2;
+
+// Vertices further than this from the origin (in pixels) can't be snapped to fixed point
+const float FIXED_POINT_LIMIT = 1 << 20;
+
+// Slack (in pixels) around the pixel bounds that the edge stepping may reach past the last pixel
+const int EDGE_STEP_SLACK = 16;
+
+// Traversal block size (blocks are aligned to multiples of this in screen space, must be <= EDGE_STEP_SLACK / 2)
+const int RASTER_BLOCK_SIZE = 8;
+
+// Round a pixel coordinate to the nearest sub-pixel step (|x| < FIXED_POINT_LIMIT, avoids a libm call)
+static inline int64_t roundToFixed(float x) {
+	float scaled = x * SUBPIXEL_ONE;
+	return static_cast<int64_t>(scaled + (scaled >= 0.f ? 0.5f : -0.5f));
+}
+
+// Fixed-Point Triangle Setup
+// Vertices are snapped to 1/16 pixel and the three edge functions become exact integers
+//   E(x, y) = A * (x - ax) + B * (y - ay)
+// evaluated at pixel centres. They are set up once at the first pixel of the bounds and then stepped
+// by adding A (one pixel right) or B (one pixel down) scaled to pixels. The edges are oriented so the
+// inside is E >= 0 for either winding, and edges that are not top or left edges are biased by -1 so a
+// pixel centre exactly on a shared edge belongs to exactly one of the two triangles.
+struct TriangleSetup {
+	int minX, minY, maxX, maxY;	 // Pixel bounds (clamped to the clip rectangle)
+	bool empty;					 // Degenerate, not representable or nothing inside the clip rectangle
+	bool fits32;				 // Every edge value the traversal can reach fits in 32 bits
+
+	int64_t edge[3];			 // Edge values at the centre of pixel (minX, minY), alpha / beta / gamma
+	int64_t stepX[3];			 // Change per pixel to the right
+	int64_t stepY[3];			 // Change per pixel down
+	float invArea;				 // 1 / (twice the snapped area), edge * invArea = barycentric
+	float z0, z1, z2;			 // Vertex depths
+
+	int laneStep[3][8];			 // Offset of each of the 8 lanes from the first (32-bit kernels, valid when fits32)
+
+	TriangleSetup(const Triangle& t, const PixelRect& clip) {
+		empty = true;
+		fits32 = false;
+		z0 = t.v0.z; z1 = t.v1.z; z2 = t.v2.z;
+
+		// Pixel bounds
+		Vec4 tr, bl;
+		findBounds(clip, t.v0, t.v1, t.v2, tr, bl);
+		if (!(tr.x >= clip.minX && tr.y >= clip.minY && bl.x < clip.maxX + 1 && bl.y < clip.maxY + 1)) return;  // Outside the clip rectangle (or NaN)
+		minX = (int)bl.x; minY = (int)bl.y;
+		maxX = (int)tr.x; maxY = (int)tr.y;
+		if (minX > maxX || minY > maxY) return;
+
+		// Snap to sub-pixel fixed point
+		const Vec4* v[3] = { &t.v0, &t.v1, &t.v2 };
+		int64_t fx[3], fy[3];
+		for (int i = 0; i < 3; i++) {
+			if (!(std::fabs(v[i]->x) < FIXED_POINT_LIMIT && std::fabs(v[i]->y) < FIXED_POINT_LIMIT)) return;
+			fx[i] = roundToFixed(v[i]->x);
+			fy[i] = roundToFixed(v[i]->y);
+		}
+
+		// Edge i is opposite vertex i (alpha = E(v1, v2), beta = E(v2, v0), gamma = E(v0, v1))
+		int64_t A[3], B[3], C[3];
+		for (int i = 0; i < 3; i++) {
+			int a = (i + 1) % 3, b = (i + 2) % 3;
+			A[i] = fy[b] - fy[a];
+			B[i] = fx[a] - fx[b];
+			C[i] = -(A[i] * fx[a] + B[i] * fy[a]);
+		}
+
+		// Twice the signed area, flip every edge for the other winding so the inside is always positive
+		int64_t area = A[2] * fx[2] + B[2] * fy[2] + C[2];
+		if (area == 0) return;
+		if (area < 0) {
+			for (int i = 0; i < 3; i++) { A[i] = -A[i]; B[i] = -B[i]; C[i] = -C[i]; }
+			area = -area;
+		}
+		invArea = 1.f / static_cast<float>(area);
+
+		// Edge values at the first pixel centre, with the top-left fill rule bias
+		int64_t px = static_cast<int64_t>(minX) * SUBPIXEL_ONE + SUBPIXEL_HALF;
+		int64_t py = static_cast<int64_t>(minY) * SUBPIXEL_ONE + SUBPIXEL_HALF;
+		for (int i = 0; i < 3; i++) {
+			bool topLeft = (A[i] > 0) || (A[i] == 0 && B[i] > 0);  // Left edge, or horizontal top edge (screen y points down)
+			edge[i] = A[i] * px + B[i] * py + C[i] + (topLeft ? 0 : -1);
+			stepX[i] = A[i] * SUBPIXEL_ONE;
+			stepY[i] = B[i] * SUBPIXEL_ONE;
+		}
+		empty = false;
+
+		// Edge functions are linear, so the extremes over the reachable rectangle are at its corners
+		const int64_t limit = INT32_MAX;
+		fits32 = true;
+		for (int i = 0; i < 3; i++) {
+			for (int corner = 0; corner < 4; corner++) {
+				int64_t cx = (corner & 1) ? (maxX - minX + EDGE_STEP_SLACK) : -EDGE_STEP_SLACK;
+				int64_t cy = (corner & 2) ? (maxY - minY + EDGE_STEP_SLACK) : -EDGE_STEP_SLACK;
+				int64_t e = edge[i] + cx * stepX[i] + cy * stepY[i];
+				if (e > limit || e < -limit) fits32 = false;
+			}
+		}
+		if (!fits32) return;
+
+		for (int i = 0; i < 3; i++)
+			for (int lane = 0; lane < 8; lane++) laneStep[i][lane] = static_cast<int>(stepX[i] * lane);
+	}
+
+	// Edge value i at the centre of pixel (x, y), anywhere on screen (same integer the traversal reaches there)
+	int64_t edgeAt(int i, int x, int y) const { return edge[i] + (x - minX) * stepX[i] + (y - minY) * stepY[i]; }
+};
+
+// Barycentrics of the pixels a kernel step accepted
+struct PixelBatch {
+	float alpha[8];
+	float beta[8];
+	float gamma[8];
+};
+
+// Tests count (1..8) pixels of a row against the triangle and the depth row. e holds the 32-bit edge values
+// at the first pixel and depth points at its depth (stored in the Depth format, see DepthFormat.h). covered =
+// the pixels are known to be inside all three edges (trivially accepted block), so only the depth test runs.
+// Returns a bitmask of pixels that are covered and pass the depth test, their depth is already written.
+template<typename Depth>
+using RasterKernel = unsigned int (*)(const TriangleSetup& s, const int* e, int count, bool covered, typename Depth::Storage* depth, PixelBatch& out);
+
+// Index of the lowest set bit (mask must not be zero)
+static inline int lowestBit(unsigned int mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// Scalar Reference Kernel
+template<typename Depth>
+static unsigned int rasterKernelScalar(const TriangleSetup& s, const int* e, int count, bool covered, typename Depth::Storage* depth, PixelBatch& out) {
+	unsigned int mask = 0;
+	for (int i = 0; i < count; i++) {
+		int e0 = e[0] + s.laneStep[0][i];
+		int e1 = e[1] + s.laneStep[1][i];
+		int e2 = e[2] + s.laneStep[2][i];
+		if (!covered && (e0 | e1 | e2) < 0) continue;  // Outside at least one edge
+
+		float alpha = static_cast<float>(e0) * s.invArea;
+		float beta = static_cast<float>(e1) * s.invArea;
+		float gamma = static_cast<float>(e2) * s.invArea;
+
+		float currentZ = (alpha * s.z0) + (beta * s.z1) + (gamma * s.z2);
+		typename Depth::Storage value = Depth::encode(currentZ);
+		if (Depth::closer(value, depth[i])) {
+			depth[i] = value;
+			out.alpha[i] = alpha;
+			out.beta[i] = beta;
+			out.gamma[i] = gamma;
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+}
+
+// 64-Bit Scalar Kernel (same test as the scalar reference, for triangles whose edge values overflow 32 bits)
+template<typename Depth>
+static unsigned int rasterKernelWide(const TriangleSetup& s, const int64_t* e, int count, bool covered, typename Depth::Storage* depth, PixelBatch& out) {
+	unsigned int mask = 0;
+	for (int i = 0; i < count; i++) {
+		int64_t e0 = e[0] + s.stepX[0] * i;
+		int64_t e1 = e[1] + s.stepX[1] * i;
+		int64_t e2 = e[2] + s.stepX[2] * i;
+		if (!covered && (e0 | e1 | e2) < 0) continue;  // Outside at least one edge
+
+		float alpha = static_cast<float>(e0) * s.invArea;
+		float beta = static_cast<float>(e1) * s.invArea;
+		float gamma = static_cast<float>(e2) * s.invArea;
+
+		float currentZ = (alpha * s.z0) + (beta * s.z1) + (gamma * s.z2);
+		typename Depth::Storage value = Depth::encode(currentZ);
+		if (Depth::closer(value, depth[i])) {
+			depth[i] = value;
+			out.alpha[i] = alpha;
+			out.beta[i] = beta;
+			out.gamma[i] = gamma;
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+}
+
+#ifdef RASTER_X86
+// SSE Depth Operations (4 pixels, encoded depths travel as 32-bit lanes whatever the storage size)
+//   encode   interpolated z to stored values, bit-identical to Depth::encode
+//   load     4 stored depths
+//   closer   lanes where the new value passes the depth test
+//   store    4 stored depths
+//   padding  a stored depth nothing can pass, for the lanes past a partial row
+template<typename Depth> struct DepthSSE;
+
+struct DepthSSEFloat {
+	static __m128i encode(__m128 z) { return _mm_castps_si128(z); }
+	static __m128i load(const float* depth) { return _mm_castps_si128(_mm_loadu_ps(depth)); }
+	static void store(float* depth, __m128i value) { _mm_storeu_ps(depth, _mm_castsi128_ps(value)); }
+};
+
+template<> struct DepthSSE<DepthFloat32> : DepthSSEFloat {
+	static __m128 closer(__m128i value, __m128i old) { return _mm_cmplt_ps(_mm_castsi128_ps(value), _mm_castsi128_ps(old)); }
+	static float padding() { return -INFINITY; }
+};
+
+template<> struct DepthSSE<DepthReversedFloat32> : DepthSSEFloat {
+	static __m128 closer(__m128i value, __m128i old) { return _mm_cmpgt_ps(_mm_castsi128_ps(value), _mm_castsi128_ps(old)); }
+	static float padding() { return INFINITY; }
+};
+
+template<typename Depth>
+struct DepthSSEUnorm {
+	static __m128i encode(__m128 z) {
+		const __m128 max = _mm_set1_ps(static_cast<float>(Depth::MAX));
+		__m128 scaled = _mm_min_ps(_mm_max_ps(_mm_mul_ps(z, max), _mm_setzero_ps()), max);	// NaN becomes 0
+		__m128i value = _mm_cvttps_epi32(_mm_add_ps(scaled, _mm_set1_ps(0.5f)));
+		const __m128i maxValue = _mm_set1_epi32(static_cast<int>(Depth::MAX));
+		__m128i over = _mm_cmpgt_epi32(value, maxValue);
+		return _mm_or_si128(_mm_andnot_si128(over, value), _mm_and_si128(over, maxValue));
+	}
+	static __m128 closer(__m128i value, __m128i old) { return _mm_castsi128_ps(_mm_cmplt_epi32(value, old)); }
+	static typename Depth::Storage padding() { return 0; }
+};
+
+template<> struct DepthSSE<DepthUnorm24> : DepthSSEUnorm<DepthUnorm24> {
+	static __m128i load(const uint32_t* depth) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(depth)); }
+	static void store(uint32_t* depth, __m128i value) { _mm_storeu_si128(reinterpret_cast<__m128i*>(depth), value); }
+};
+
+template<> struct DepthSSE<DepthUnorm16> : DepthSSEUnorm<DepthUnorm16> {
+	static __m128i load(const uint16_t* depth) {
+		return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(depth)), _mm_setzero_si128());
+	}
+	static void store(uint16_t* depth, __m128i value) {
+		// SSE2 only packs signed, so shift 0..65535 into the signed range and back
+		__m128i packed = _mm_packs_epi32(_mm_sub_epi32(value, _mm_set1_epi32(32768)), _mm_setzero_si128());
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(depth), _mm_add_epi16(packed, _mm_set1_epi16(-32768)));
+	}
+};
+
+// SSE Kernel (two 4-wide halves, SSE2 only)
+template<typename Depth>
+static unsigned int rasterKernelSSE(const TriangleSetup& s, const int* e, int count, bool covered, typename Depth::Storage* depth, PixelBatch& out) {
+	typedef DepthSSE<Depth> Ops;
+	const __m128 invArea = _mm_set1_ps(s.invArea);
+
+	// Pad partial steps with a depth nothing passes so missing pixels can never pass
+	alignas(16) typename Depth::Storage depthIn[8];
+	const typename Depth::Storage* src = depth;
+	if (count < 8) {
+		for (int i = 0; i < 8; i++) depthIn[i] = (i < count) ? depth[i] : Ops::padding();
+		src = depthIn;
+	}
+
+	unsigned int mask = 0;
+	for (int half = 0; half < 2; half++) {
+		__m128i e0 = _mm_add_epi32(_mm_set1_epi32(e[0]), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.laneStep[0] + half * 4)));
+		__m128i e1 = _mm_add_epi32(_mm_set1_epi32(e[1]), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.laneStep[1] + half * 4)));
+		__m128i e2 = _mm_add_epi32(_mm_set1_epi32(e[2]), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.laneStep[2] + half * 4)));
+
+		// Coverage (sign bit of any edge set = outside)
+		__m128 outside = covered ? _mm_setzero_ps() : _mm_castsi128_ps(_mm_or_si128(_mm_or_si128(e0, e1), e2));
+		if (_mm_movemask_ps(outside) == 0xF) continue;
+
+		// Depth test
+		__m128 alpha = _mm_mul_ps(_mm_cvtepi32_ps(e0), invArea);
+		__m128 beta = _mm_mul_ps(_mm_cvtepi32_ps(e1), invArea);
+		__m128 gamma = _mm_mul_ps(_mm_cvtepi32_ps(e2), invArea);
+		__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(s.z0)), _mm_mul_ps(beta, _mm_set1_ps(s.z1))), _mm_mul_ps(gamma, _mm_set1_ps(s.z2)));
+		__m128i value = Ops::encode(z);
+		__m128i old = Ops::load(src + half * 4);
+		__m128 pass = _mm_andnot_ps(_mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(outside), 31)), Ops::closer(value, old));
+		unsigned int bits = static_cast<unsigned int>(_mm_movemask_ps(pass));
+		if (bits == 0) continue;
+
+		// Depth write
+		if (count == 8) {
+			__m128i passBits = _mm_castps_si128(pass);
+			Ops::store(depth + half * 4, _mm_or_si128(_mm_and_si128(passBits, value), _mm_andnot_si128(passBits, old)));
+		}
+		else {
+			alignas(16) float zs[4];
+			_mm_store_ps(zs, z);
+			for (unsigned int b = bits; b; b &= b - 1) depth[half * 4 + lowestBit(b)] = Depth::encode(zs[lowestBit(b)]);
+		}
+
+		_mm_storeu_ps(out.alpha + half * 4, alpha);
+		_mm_storeu_ps(out.beta + half * 4, beta);
+		_mm_storeu_ps(out.gamma + half * 4, gamma);
+		mask |= bits << (half * 4);
+	}
+	return mask;
+}
+
+// AVX2 Depth Operations (8 pixels, same roles as DepthSSE, lanes past count are never loaded or stored)
+template<typename Depth> struct DepthAVX2;
+
+struct DepthAVX2Float {
+	RASTER_TARGET_AVX2 static __m256i encode(__m256 z) { return _mm256_castps_si256(z); }
+	RASTER_TARGET_AVX2 static __m256i load(const float* depth, __m256i lanes, int) { return _mm256_castps_si256(_mm256_maskload_ps(depth, lanes)); }
+	RASTER_TARGET_AVX2 static void store(float* depth, __m256i value, __m256i, __m256 pass, int) {
+		_mm256_maskstore_ps(depth, _mm256_castps_si256(pass), _mm256_castsi256_ps(value));
+	}
+};
+
+template<> struct DepthAVX2<DepthFloat32> : DepthAVX2Float {
+	RASTER_TARGET_AVX2 static __m256 closer(__m256i value, __m256i old) { return _mm256_cmp_ps(_mm256_castsi256_ps(value), _mm256_castsi256_ps(old), _CMP_LT_OQ); }
+};
+
+template<> struct DepthAVX2<DepthReversedFloat32> : DepthAVX2Float {
+	RASTER_TARGET_AVX2 static __m256 closer(__m256i value, __m256i old) { return _mm256_cmp_ps(_mm256_castsi256_ps(value), _mm256_castsi256_ps(old), _CMP_GT_OQ); }
+};
+
+template<typename Depth>
+struct DepthAVX2Unorm {
+	RASTER_TARGET_AVX2 static __m256i encode(__m256 z) {
+		const __m256 max = _mm256_set1_ps(static_cast<float>(Depth::MAX));
+		__m256 scaled = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(z, max), _mm256_setzero_ps()), max);  // NaN becomes 0
+		__m256i value = _mm256_cvttps_epi32(_mm256_add_ps(scaled, _mm256_set1_ps(0.5f)));
+		return _mm256_min_epi32(value, _mm256_set1_epi32(static_cast<int>(Depth::MAX)));
+	}
+	RASTER_TARGET_AVX2 static __m256 closer(__m256i value, __m256i old) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(old, value)); }
+};
+
+template<> struct DepthAVX2<DepthUnorm24> : DepthAVX2Unorm<DepthUnorm24> {
+	RASTER_TARGET_AVX2 static __m256i load(const uint32_t* depth, __m256i lanes, int) {
+		return _mm256_maskload_epi32(reinterpret_cast<const int*>(depth), lanes);
+	}
+	RASTER_TARGET_AVX2 static void store(uint32_t* depth, __m256i value, __m256i, __m256 pass, int) {
+		_mm256_maskstore_epi32(reinterpret_cast<int*>(depth), _mm256_castps_si256(pass), value);
+	}
+};
+
+template<> struct DepthAVX2<DepthUnorm16> : DepthAVX2Unorm<DepthUnorm16> {
+	// No 16-bit masked loads and stores, partial rows go through a copy
+	RASTER_TARGET_AVX2 static __m256i load(const uint16_t* depth, __m256i, int count) {
+		if (count == 8) return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth)));
+		alignas(16) uint16_t padded[8] = {};
+		for (int i = 0; i < count; i++) padded[i] = depth[i];
+		return _mm256_cvtepu16_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(padded)));
+	}
+	RASTER_TARGET_AVX2 static void store(uint16_t* depth, __m256i value, __m256i old, __m256 pass, int count) {
+		__m256i merged = _mm256_blendv_epi8(old, value, _mm256_castps_si256(pass));
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(merged, merged), 0x08);	 // packus works per 128-bit half
+		if (count == 8) _mm_storeu_si128(reinterpret_cast<__m128i*>(depth), _mm256_castsi256_si128(packed));
+		else {
+			alignas(16) uint16_t lanes[8];
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), _mm256_castsi256_si128(packed));
+			for (int i = 0; i < count; i++) depth[i] = lanes[i];
+		}
+	}
+};
+
+// AVX2 Kernel (8 pixels per step)
+template<typename Depth>
+RASTER_TARGET_AVX2 static unsigned int rasterKernelAVX2(const TriangleSetup& s, const int* e, int count, bool covered, typename Depth::Storage* depth, PixelBatch& out) {
+	typedef DepthAVX2<Depth> Ops;
+	__m256i e0 = _mm256_add_epi32(_mm256_set1_epi32(e[0]), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s.laneStep[0])));
+	__m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(e[1]), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s.laneStep[1])));
+	__m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(e[2]), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s.laneStep[2])));
+
+	// Coverage (sign bit of any edge set = outside, lanes past count are masked off and never loaded or stored)
+	const __m256i lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i inside = lanes;
+	if (!covered) {
+		inside = _mm256_srai_epi32(_mm256_andnot_si256(_mm256_or_si256(_mm256_or_si256(e0, e1), e2), lanes), 31);
+		if (_mm256_testz_si256(inside, inside)) return 0;
+	}
+
+	// Depth test
+	const __m256 invArea = _mm256_set1_ps(s.invArea);
+	__m256 alpha = _mm256_mul_ps(_mm256_cvtepi32_ps(e0), invArea);
+	__m256 beta = _mm256_mul_ps(_mm256_cvtepi32_ps(e1), invArea);
+	__m256 gamma = _mm256_mul_ps(_mm256_cvtepi32_ps(e2), invArea);
+	__m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, _mm256_set1_ps(s.z0)), _mm256_mul_ps(beta, _mm256_set1_ps(s.z1))), _mm256_mul_ps(gamma, _mm256_set1_ps(s.z2)));
+	__m256i value = Ops::encode(z);
+	__m256i old = Ops::load(depth, inside, count);
+	__m256 pass = _mm256_and_ps(_mm256_castsi256_ps(inside), Ops::closer(value, old));
+	unsigned int mask = static_cast<unsigned int>(_mm256_movemask_ps(pass));
+	if (mask == 0) return 0;
+
+	// Depth write
+	Ops::store(depth, value, old, pass, count);
+
+	_mm256_storeu_ps(out.alpha, alpha);
+	_mm256_storeu_ps(out.beta, beta);
+	_mm256_storeu_ps(out.gamma, gamma);
+	return mask;
+}
+
+// CPU Feature Detection
+static bool cpuSupportsAVX2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;  // OS must save YMM state
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// Best kernel this CPU supports
+static RasterKernelType detectRasterKernel() {
+#ifdef RASTER_X86
+	if (cpuSupportsAVX2()) return RasterKernelType::AVX2;
+	return RasterKernelType::SSE;
+#else
+	return RasterKernelType::Scalar;
+#endif
+}
+
+// Kernel used by the rasterizer (detected once, can be overridden for validation and benchmarking)
+static RasterKernelType& activeRasterKernelType() {
+	static RasterKernelType type = detectRasterKernel();
+	return type;
+}
+
+template<typename Depth>
+static RasterKernel<Depth> rasterKernel() {
+#ifdef RASTER_X86
+	switch (activeRasterKernelType()) {
+	case RasterKernelType::AVX2: return rasterKernelAVX2<Depth>;
+	case RasterKernelType::SSE: return rasterKernelSSE<Depth>;
+	default: break;
+	}
+#endif
+	return rasterKernelScalar<Depth>;
+}
+
+// Select a kernel by name ("scalar", "sse" or "avx2"), returns false if unknown or unsupported on this CPU
+static bool setRasterKernel(const std::string& name) {
+	RasterKernelType type;
+	if (name == "scalar") type = RasterKernelType::Scalar;
+	else if (name == "sse") type = RasterKernelType::SSE;
+	else if (name == "avx2") type = RasterKernelType::AVX2;
+	else return false;
+	if (type > detectRasterKernel()) return false;
+	activeRasterKernelType() = type;
+	return true;
+}
+
+static const char* rasterKernelName() {
+	switch (activeRasterKernelType()) {
+	case RasterKernelType::AVX2: return "avx2";
+	case RasterKernelType::SSE: return "sse";
+	default: return "scalar";
+	}
+}
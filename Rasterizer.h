@@ -0,0 +1,224 @@
+#pragma once
+
+#include "MyMath.h"
+#include "RasterKernel.h"
+#include "RenderTarget.h"
+#include "Shaders.h"
+
+// Perspective-Correct Varyings
+// Triangle setup turns each varying times 1/w, and 1/w itself, into a plane equation over the screen
+//   value(x, y) = a + dx * (x - originX) + dy * (y - originY)
+// packed four to a Vec4 (the varyings in order, then 1/w), so a pixel costs two multiply-adds per four
+// varyings plus a single reciprocal, for any number of varyings. The planes come from the exact integer
+// edge functions at a pixel picked by the triangle alone, so setups clipped to different rectangles
+// (tiles) give identical planes.
+template<int N>
+struct VaryingPlanes {
+	static const int GROUPS = (N + 4) / 4;	// N varyings + 1/w, four per Vec4
+
+	int originX, originY;					// Pixel the planes are relative to (the one holding vertex 0)
+	Vec4 a[GROUPS], dx[GROUPS], dy[GROUPS];
+
+	// Unset planes (assigned later, e.g. by a setup job)
+	VaryingPlanes() : originX(0), originY(0) {}
+
+	// Planes through the N varyings at each vertex (t's w already holds 1/w)
+	VaryingPlanes(const TriangleSetup& s, const Triangle& t, const float* v0, const float* v1, const float* v2) {
+		originX = static_cast<int>(std::floor(t.v0.x));
+		originY = static_cast<int>(std::floor(t.v0.y));
+
+		// Barycentric weights at the origin and their steps, edge * invArea
+		double weight[3], weightX[3], weightY[3];
+		for (int i = 0; i < 3; i++) {
+			weight[i] = static_cast<double>(s.edgeAt(i, originX, originY)) * s.invArea;
+			weightX[i] = static_cast<double>(s.stepX[i]) * s.invArea;
+			weightY[i] = static_cast<double>(s.stepY[i]) * s.invArea;
+		}
+
+		const float w[3] = { t.v0.w, t.v1.w, t.v2.w };
+		const float* v[3] = { v0, v1, v2 };
+		for (int k = 0; k < GROUPS * 4; k++) {
+			double q[3];
+			for (int i = 0; i < 3; i++) q[i] = (k < N) ? v[i][k] * w[i] : (k == N) ? w[i] : 0.f;
+			a[k / 4][k % 4] = static_cast<float>(q[0] * weight[0] + q[1] * weight[1] + q[2] * weight[2]);
+			dx[k / 4][k % 4] = static_cast<float>(q[0] * weightX[0] + q[1] * weightX[1] + q[2] * weightX[2]);
+			dy[k / 4][k % 4] = static_cast<float>(q[0] * weightY[0] + q[1] * weightY[1] + q[2] * weightY[2]);
+		}
+	}
+
+	// Interpolate every varying at the centre of pixel (x, y), out[k / 4][k % 4] = varying k (lanes past the
+	// last varying are unspecified)
+	void interpolate(int x, int y, Vec4 out[GROUPS]) const {
+		float fx = static_cast<float>(x - originX), fy = static_cast<float>(y - originY);
+		for (int g = 0; g < GROUPS; g++) out[g] = a[g] + dx[g] * fx + dy[g] * fy;
+		float w = 1.f / out[N / 4][N % 4];
+		for (int g = 0; g < GROUPS; g++) out[g] *= w;
+	}
+};
+
+// Triangle traversal with the depth test and write specialised for one depth format (Depth = the traits of
+// the target's format, see traverseTriangle)
+template<typename Depth, typename Shade>
+void traverseTriangleWithDepth(RenderTarget& target, const TriangleSetup& s, Shade& shade) {
+	// Coverage, depth test and depth write run 8 pixels at a time in the SIMD kernel, edges step by integer adds
+	// (triangles whose edge values don't fit in 32 bits take the 64-bit scalar kernel)
+	RasterKernel<Depth> kernel = rasterKernel<Depth>();
+	PixelBatch batch;
+	typename Depth::Storage* depth = target.depthBuffer<Depth>();
+
+	// Edge values are linear, so over a block they peak and bottom out at opposite corners
+	const int B = RASTER_BLOCK_SIZE;
+	static_assert(RASTER_BLOCK_SIZE == HIZ_CELL_SIZE, "traversal blocks must line up with the Hi-Z cells");
+	int64_t blockMax[3], blockMin[3];
+	for (int k = 0; k < 3; k++) {
+		blockMax[k] = (std::max<int64_t>(s.stepX[k], 0) + std::max<int64_t>(s.stepY[k], 0)) * (B - 1);
+		blockMin[k] = (std::min<int64_t>(s.stepX[k], 0) + std::min<int64_t>(s.stepY[k], 0)) * (B - 1);
+	}
+
+	// Walk the screen-aligned 8x8 blocks overlapping the bounds: blocks outside an edge are skipped, blocks
+	// inside all three edges skip the per-pixel edge tests, only blocks crossing an edge test every pixel.
+	// Triangles no bigger than a block aren't worth classifying and test every pixel of the (at most four)
+	// blocks they overlap. Every block is one tile of the target, so each row the kernel runs is contiguous.
+	bool small = s.maxX - s.minX < B && s.maxY - s.minY < B;
+	int startX = s.minX & ~(B - 1);
+	int startY = s.minY & ~(B - 1);
+	int64_t blockRow[3];
+	for (int k = 0; k < 3; k++) blockRow[k] = s.edge[k] + (startX - s.minX) * s.stepX[k] + (startY - s.minY) * s.stepY[k];
+
+	// Nearest depth the triangle can produce. The fill rule bias can make the weights sum to slightly less than
+	// one, and the bound is widened a little more for the rounding of the per-pixel interpolation. The bounds are
+	// worked out on distances (z, or -z under reversed-Z, so nearer is always smaller).
+	const float sign = Depth::REVERSED ? -1.f : 1.f;
+	const float z[3] = { sign * s.z0, sign * s.z1, sign * s.z2 };
+	float zSlack = 1e-5f * std::max(std::max(std::fabs(z[0]), std::fabs(z[1])), std::fabs(z[2]));
+	float zMin = std::min(std::min(z[0], z[1]), z[2]);
+	float zNearest = std::min(zMin, zMin * (1.f - 2.f * s.invArea)) - zSlack;
+
+	// Bigger triangles bound each block tighter: depth is linear in the edge values, so over a block it
+	// bottoms out at a corner as well
+	double zPlane[3] = { 0.0, 0.0, 0.0 };
+	double zReach = 0.0;
+	if (!small) {
+		double zStepX = 0.0, zStepY = 0.0;
+		for (int k = 0; k < 3; k++) {
+			zPlane[k] = static_cast<double>(z[k]) * s.invArea;
+			zStepX += s.stepX[k] * zPlane[k];
+			zStepY += s.stepY[k] * zPlane[k];
+		}
+		zReach = (std::min(zStepX, 0.0) + std::min(zStepY, 0.0)) * (B - 1);
+	}
+
+	for (int by = startY; by <= s.maxY; by += B) {
+		int64_t block[3] = { blockRow[0], blockRow[1], blockRow[2] };
+		for (int bx = startX; bx <= s.maxX; bx += B) {
+			bool outside = false, covered = !small;
+			for (int k = 0; k < 3 && !small; k++) {
+				outside |= block[k] + blockMax[k] < 0;
+				covered &= block[k] + blockMin[k] >= 0;
+			}
+
+			int x0 = std::max(bx, s.minX), x1 = std::min(bx + B - 1, s.maxX);
+			int y0 = std::max(by, s.minY), y1 = std::min(by + B - 1, s.maxY);
+
+			// Hi-Z: skip the block if its nearest depth is behind everything already drawn there
+			if (!outside) {
+				float nearest = zNearest;
+				if (!small) {
+					double zBlock = zReach;
+					for (int k = 0; k < 3; k++) zBlock += block[k] * zPlane[k];
+					nearest = std::max(nearest, static_cast<float>(zBlock) - zSlack);
+				}
+				outside = Depth::key(Depth::encode(sign * nearest)) >= target.farthestDepth(bx / B, by / B);
+			}
+
+			if (!outside) {
+				target.touchCell(bx / B, by / B);  // First write into a cell this frame clears it
+
+				int count = x1 - x0 + 1;
+				int64_t e[3];
+				for (int k = 0; k < 3; k++) e[k] = block[k] + (x0 - bx) * s.stepX[k] + (y0 - by) * s.stepY[k];
+
+				typename Depth::Storage* depthRow = depth + target.pixelIndex(x0, y0);
+				for (int y = y0; y <= y1; y++, depthRow += B) {
+					unsigned int mask;
+					if (s.fits32) {
+						int e32[3] = { static_cast<int>(e[0]), static_cast<int>(e[1]), static_cast<int>(e[2]) };
+						mask = kernel(s, e32, count, covered, depthRow, batch);
+					}
+					else mask = rasterKernelWide<Depth>(s, e, count, covered, depthRow, batch);
+					if (mask) target.depthWritten(x0, x1, y);
+
+					// Shade the pixels that passed
+					for (; mask; mask &= mask - 1) {
+						int i = lowestBit(mask);
+						shade(x0 + i, y, batch.alpha[i], batch.beta[i], batch.gamma[i]);
+					}
+					for (int k = 0; k < 3; k++) e[k] += s.stepY[k];
+				}
+			}
+			for (int k = 0; k < 3; k++) block[k] += s.stepX[k] * B;
+		}
+		for (int k = 0; k < 3; k++) blockRow[k] += s.stepY[k] * B;
+	}
+}
+
+// Walk every pixel of the triangle inside the setup's bounds that passes the depth test (depth is already
+// written) and call shade(x, y, alpha, beta, gamma) for it. Blocks the target's Hi-Z proves hidden are skipped.
+template<typename Shade>
+void traverseTriangle(RenderTarget& target, const TriangleSetup& s, Shade&& shade) {
+	if (s.empty) return;
+	switch (target.getDepthFormat()) {
+	case DepthFormat::Float32: traverseTriangleWithDepth<DepthFloat32>(target, s, shade); break;
+	case DepthFormat::ReversedFloat32: traverseTriangleWithDepth<DepthReversedFloat32>(target, s, shade); break;
+	case DepthFormat::Unorm24: traverseTriangleWithDepth<DepthUnorm24>(target, s, shade); break;
+	case DepthFormat::Unorm16: traverseTriangleWithDepth<DepthUnorm16>(target, s, shade); break;
+	}
+}
+
+template<typename Shade>
+void traverseTriangle(RenderTarget& target, const Triangle& t, const PixelRect& clip, Shade&& shade) {
+	traverseTriangle(target, TriangleSetup(t, clip), shade);
+}
+
+// Varying planes of a triangle, from the shader's vertex stage run on its three vertices
+template<typename Shader>
+VaryingPlanes<Shader::VARYINGS> setupVaryings(const Shader& shader, const TriangleSetup& s, const Triangle& t,
+											  const typename Shader::Vertex& a, const typename Shader::Vertex& b, const typename Shader::Vertex& c) {
+	float v0[Shader::VARYINGS], v1[Shader::VARYINGS], v2[Shader::VARYINGS];
+	shader.vertex(a, v0);
+	shader.vertex(b, v1);
+	shader.vertex(c, v2);
+	return VaryingPlanes<Shader::VARYINGS>(s, t, v0, v1, v2);
+}
+
+// Rasterize and shade a screen-space triangle with the given shader (only pixels inside clip are touched)
+template<typename Shader>
+void rasterizeTriangle(RenderTarget& target, const Triangle& t, const Shader& shader,
+					   const typename Shader::Vertex& a, const typename Shader::Vertex& b, const typename Shader::Vertex& c, const PixelRect& clip) {
+	TriangleSetup s(t, clip);
+	if (s.empty) return;
+
+	VaryingPlanes<Shader::VARYINGS> planes = setupVaryings(shader, s, t, a, b, c);
+	traverseTriangle(target, s, [&](int x, int y, float, float, float) {
+		Vec4 varyings[VaryingPlanes<Shader::VARYINGS>::GROUPS];
+		planes.interpolate(x, y, varyings);
+		Colour finalColor = shader.fragment(varyings);
+
+		// Draw Pixel
+		target.draw(x, y, finalColor.toRGBA8());
+	});
+}
+
+// Rainbow triangle (blue, green and red vertices)
+void rasterizeTriangle(RenderTarget& target, const Triangle& t, const PixelRect& clip) {
+	rasterizeTriangle(target, t, VertexColourShader(), Colour(0.f, 0.f, 1.f), Colour(0.f, 1.f, 0.f), Colour(1.f, 0.f, 0.f), clip);
+}
+
+// Lambertian shading of interpolated vertex normals
+void rasterizeTriangle(RenderTarget& target, const Triangle& t, const Vec4& n0, const Vec4& n1, const Vec4& n2, const PixelRect& clip) {
+	rasterizeTriangle(target, t, LambertShader(), n0, n1, n2, clip);
+}
+
+// Whole-target versions
+void rasterizeTriangle(RenderTarget& target, const Triangle& t) { rasterizeTriangle(target, t, target.getBounds()); }
+void rasterizeTriangle(RenderTarget& target, const Triangle& t, const Vec4& n0, const Vec4& n1, const Vec4& n2) { rasterizeTriangle(target, t, n0, n1, n2, target.getBounds()); }
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "DepthFormat.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
+// Hi-Z cell size in pixels (the depth buffer keeps the farthest depth of every cell of this size)
+const int HIZ_CELL_SIZE = 8;
+
+// Row writes a Hi-Z cell collects before it is worth recomputing
+const int HIZ_REFRESH_WRITES = 4;
+
+// Pixels per memory tile (colour and depth are stored as HIZ_CELL_SIZE x HIZ_CELL_SIZE tiles, one Hi-Z cell each)
+const int TILE_PIXELS = HIZ_CELL_SIZE * HIZ_CELL_SIZE;
+
+// Pixel Rectangle (inclusive bounds, used for the whole target and for screen tiles)
+struct PixelRect {
+	int minX, minY, maxX, maxY;
+};
+
+// Render Target Interface (colour + depth storage the pipeline renders into)
+// Colour and depth are stored tiled: the target is split into 8x8 tiles (the Hi-Z cells) in row-major order,
+// and each tile holds its 64 pixels contiguously, row by row. A triangle's rows then stay within a few cache
+// lines instead of touching a new line every row. Colour is RGBA8, one aligned 32-bit store per pixel, and
+// packRGB24() detiles it into the linear RGB24 image only when something needs that format (a window's back
+// buffer or a PPM file). Depth is stored in the target's DepthFormat, only that format's buffer is allocated.
+class RenderTarget {
+protected:
+	unsigned int width = 0;				 // Target width in pixels
+	unsigned int height = 0;			 // Target height in pixels
+	std::vector<unsigned int> colour;	 // Tiled RGBA8 colour (r in the lowest byte, see Colour::toRGBA8)
+
+	// Tiled depth, one value per pixel
+	DepthFormat depthFormat = DepthFormat::Float32;
+	std::vector<float> depthFloat;		   // Float32 and ReversedFloat32
+	std::vector<uint32_t> depthUnorm24;	   // Unorm24
+	std::vector<uint16_t> depthUnorm16;	   // Unorm16
+
+	// Hi-Z: farthest depth of every 8x8 cell, as a DepthFormat key (grows with distance in every format). Depth
+	// writes only ever bring depth closer, so a stale entry is still a safe upper bound. Writers just count their
+	// row writes per cell, and a cell is recomputed when it is read after collecting enough of them.
+	unsigned int hiZWidth = 0;			 // Cells per row
+	std::vector<float> hiZ;				 // Farthest depth key per cell
+	std::vector<unsigned char> hiZWrites;  // Row writes into the cell since hiZ was last recomputed
+	float hiZClear = 1.f;				 // Key of the clear depth
+
+	// Lazy clears: clear() only starts a new frame epoch, and each 8x8 cell is cleared the first time the
+	// rasterizer touches it in that frame. Cells nothing touched are packed as the clear colour by packRGB24().
+	unsigned int frameEpoch = 1;
+	std::vector<unsigned int> cellEpoch;  // Frame the cell was last cleared in
+
+	// Concrete targets call this once they know their size
+	void initialize(unsigned int _width, unsigned int _height, DepthFormat _depthFormat) {
+		width = _width;
+		height = _height;
+		depthFormat = _depthFormat;
+		hiZWidth = (width + HIZ_CELL_SIZE - 1) / HIZ_CELL_SIZE;
+		size_t cells = static_cast<size_t>(hiZWidth) * ((height + HIZ_CELL_SIZE - 1) / HIZ_CELL_SIZE);
+		colour.assign(cells * TILE_PIXELS, 0);	// Edge tiles are padded to full tiles
+
+		depthFloat.clear(); depthUnorm24.clear(); depthUnorm16.clear();
+		switch (depthFormat) {
+		case DepthFormat::Float32: depthFloat.assign(cells * TILE_PIXELS, DepthFloat32::clearValue()); hiZClear = DepthFloat32::key(DepthFloat32::clearValue()); break;
+		case DepthFormat::ReversedFloat32: depthFloat.assign(cells * TILE_PIXELS, DepthReversedFloat32::clearValue()); hiZClear = DepthReversedFloat32::key(DepthReversedFloat32::clearValue()); break;
+		case DepthFormat::Unorm24: depthUnorm24.assign(cells * TILE_PIXELS, DepthUnorm24::clearValue()); hiZClear = DepthUnorm24::key(DepthUnorm24::clearValue()); break;
+		case DepthFormat::Unorm16: depthUnorm16.assign(cells * TILE_PIXELS, DepthUnorm16::clearValue()); hiZClear = DepthUnorm16::key(DepthUnorm16::clearValue()); break;
+		}
+		hiZ.assign(cells, hiZClear);
+		hiZWrites.assign(cells, 0);
+		frameEpoch = 1;
+		cellEpoch.assign(hiZ.size(), 0);
+	}
+
+	// Depth storage of each format (overloaded on the storage type, see depthBuffer)
+	float* depthStorage(float*) { return depthFloat.data(); }
+	uint32_t* depthStorage(uint32_t*) { return depthUnorm24.data(); }
+	uint16_t* depthStorage(uint16_t*) { return depthUnorm16.data(); }
+
+	// Clear a whole tile of depth
+	template<typename Depth>
+	void clearDepthTile(size_t cell) {
+		typename Depth::Storage* tile = depthBuffer<Depth>() + cell * TILE_PIXELS;
+		std::fill(tile, tile + TILE_PIXELS, Depth::clearValue());
+	}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	// Keys of four consecutive stored depths (the traits argument only picks the format)
+	static __m128 loadKeys(DepthFloat32, const float* depth) { return _mm_loadu_ps(depth); }
+	static __m128 loadKeys(DepthReversedFloat32, const float* depth) { return _mm_xor_ps(_mm_loadu_ps(depth), _mm_set1_ps(-0.f)); }
+	static __m128 loadKeys(DepthUnorm24, const uint32_t* depth) { return _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth))); }
+	static __m128 loadKeys(DepthUnorm16, const uint16_t* depth) {
+		return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(depth)), _mm_setzero_si128()));
+	}
+#endif
+
+	// Farthest key among the first w x h pixels of a tile
+	template<typename Depth>
+	float farthestKey(size_t cell, int w, int h) {
+		const typename Depth::Storage* tile = depthBuffer<Depth>() + cell * TILE_PIXELS;
+		float farthest = -INFINITY;
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+		if (w == HIZ_CELL_SIZE && h == HIZ_CELL_SIZE) {
+			// Whole tile: two 4-wide running maxima over its 64 consecutive depths
+			__m128 left = _mm_set1_ps(-INFINITY), right = left;
+			for (int i = 0; i < TILE_PIXELS; i += 8) {
+				left = _mm_max_ps(left, loadKeys(Depth(), tile + i));
+				right = _mm_max_ps(right, loadKeys(Depth(), tile + i + 4));
+			}
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, _mm_max_ps(left, right));
+			return std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+		}
+#endif
+		// Edge tile, the padding never gets written
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++) farthest = std::max(farthest, Depth::key(tile[y * HIZ_CELL_SIZE + x]));
+		return farthest;
+	}
+
+	// Cell bounds (exclusive upper ends, clamped to the target)
+	void cellBounds(int cellX, int cellY, int& x0, int& x1, int& y0, int& y1) const {
+		x0 = cellX * HIZ_CELL_SIZE; x1 = std::min(x0 + HIZ_CELL_SIZE, static_cast<int>(width));
+		y0 = cellY * HIZ_CELL_SIZE; y1 = std::min(y0 + HIZ_CELL_SIZE, static_cast<int>(height));
+	}
+
+	// Detile the colour into a linear RGB24 image of width * height pixels, cells nothing touched this frame get
+	// the clear colour
+	void packRGB24(unsigned char* out) const {
+		for (int cellY = 0; cellY * HIZ_CELL_SIZE < static_cast<int>(height); cellY++) {
+			size_t cell = static_cast<size_t>(cellY) * hiZWidth;
+			for (int cellX = 0; cellX < static_cast<int>(hiZWidth); cellX++, cell++) {
+				int x0, x1, y0, y1;
+				cellBounds(cellX, cellY, x0, x1, y0, y1);
+				const unsigned int* src = &colour[cell * TILE_PIXELS];
+				bool touched = cellEpoch[cell] == frameEpoch;
+				for (int y = y0; y < y1; y++, src += HIZ_CELL_SIZE) {
+					unsigned char* dst = &out[(static_cast<size_t>(y) * width + x0) * 3];
+					if (!touched) {
+						memset(dst, 0, (x1 - x0) * 3);
+						continue;
+					}
+					for (int x = 0; x < x1 - x0; x++, dst += 3) {
+						unsigned int pixel = src[x];
+						dst[0] = static_cast<unsigned char>(pixel);
+						dst[1] = static_cast<unsigned char>(pixel >> 8);
+						dst[2] = static_cast<unsigned char>(pixel >> 16);
+					}
+				}
+			}
+		}
+	}
+
+public:
+	virtual ~RenderTarget() {}
+
+	// Dimensions
+	unsigned int getWidth() const { return width; }
+	unsigned int getHeight() const { return height; }
+	PixelRect getBounds() const { return { 0, 0, static_cast<int>(width) - 1, static_cast<int>(height) - 1 }; }
+
+	// Offset of pixel (x, y) in the tiled buffers (the pixels of one tile row are consecutive)
+	size_t pixelIndex(int x, int y) const {
+		unsigned int ux = x, uy = y;  // Never negative, unsigned lets the divisions become shifts
+		size_t tile = static_cast<size_t>(uy / HIZ_CELL_SIZE) * hiZWidth + ux / HIZ_CELL_SIZE;
+		return tile * TILE_PIXELS + (uy % HIZ_CELL_SIZE) * HIZ_CELL_SIZE + ux % HIZ_CELL_SIZE;
+	}
+
+	// Depth format (fixed when the target is created)
+	DepthFormat getDepthFormat() const { return depthFormat; }
+
+	// Raw buffer access (no bounds checks, index with pixelIndex, writes must stay in cells touched this frame and
+	// must only bring depth closer, or the Hi-Z falls out of date). Depth must be the traits of getDepthFormat().
+	unsigned int* colourBuffer() { return colour.data(); }
+	template<typename Depth>
+	typename Depth::Storage* depthBuffer() { return depthStorage(static_cast<typename Depth::Storage*>(nullptr)); }
+
+	// Depth at (x, y) as z in [0, 1] (reversed-Z: 1 = near)
+	float depthAt(int x, int y) {
+		size_t cell = static_cast<size_t>(y / HIZ_CELL_SIZE) * hiZWidth + x / HIZ_CELL_SIZE;
+		bool touched = cellEpoch[cell] == frameEpoch;  // Untouched cells still hold an earlier frame's depth
+		size_t index = pixelIndex(x, y);
+		switch (depthFormat) {
+		case DepthFormat::Float32: return touched ? depthFloat[index] : DepthFloat32::clearValue();
+		case DepthFormat::ReversedFloat32: return touched ? depthFloat[index] : DepthReversedFloat32::clearValue();
+		case DepthFormat::Unorm24: return DepthUnorm24::decode(touched ? depthUnorm24[index] : DepthUnorm24::clearValue());
+		default: return DepthUnorm16::decode(touched ? depthUnorm16[index] : DepthUnorm16::clearValue());
+		}
+	}
+
+	// Record a depth write to pixels x0..x1 of row y (x1 - x0 < HIZ_CELL_SIZE)
+	void depthWritten(int x0, int x1, int y) {
+		unsigned char* row = &hiZWrites[(y / HIZ_CELL_SIZE) * hiZWidth];
+		int c0 = x0 / HIZ_CELL_SIZE, c1 = x1 / HIZ_CELL_SIZE;
+		if (row[c0] < HIZ_REFRESH_WRITES) row[c0]++;
+		if (c1 != c0 && row[c1] < HIZ_REFRESH_WRITES) row[c1]++;
+	}
+
+	// Clear cell (cellX, cellY) if this is the first time it is touched this frame, must be called before any
+	// pixel of the cell is read or written (cells are only ever touched by the thread that owns their screen tile)
+	void touchCell(int cellX, int cellY) {
+		size_t cell = static_cast<size_t>(cellY) * hiZWidth + cellX;
+		if (cellEpoch[cell] == frameEpoch) return;
+		cellEpoch[cell] = frameEpoch;
+		hiZ[cell] = hiZClear;
+		hiZWrites[cell] = 0;
+
+		// The whole tile is one contiguous run in each buffer
+		switch (depthFormat) {
+		case DepthFormat::Float32: clearDepthTile<DepthFloat32>(cell); break;
+		case DepthFormat::ReversedFloat32: clearDepthTile<DepthReversedFloat32>(cell); break;
+		case DepthFormat::Unorm24: clearDepthTile<DepthUnorm24>(cell); break;
+		case DepthFormat::Unorm16: clearDepthTile<DepthUnorm16>(cell); break;
+		}
+		std::fill(&colour[cell * TILE_PIXELS], &colour[(cell + 1) * TILE_PIXELS], 0u);
+	}
+
+	// Farthest depth key (see DepthFormat) in Hi-Z cell (cellX, cellY), a fragment whose key is at or past this
+	// can't pass the depth test
+	float farthestDepth(int cellX, int cellY) {
+		size_t cell = static_cast<size_t>(cellY) * hiZWidth + cellX;
+		if (cellEpoch[cell] != frameEpoch) return hiZClear;  // Not touched yet, still at the clear depth
+		if (hiZWrites[cell] >= HIZ_REFRESH_WRITES) {
+			int x0, x1, y0, y1;
+			cellBounds(cellX, cellY, x0, x1, y0, y1);
+			float farthest = -INFINITY;
+			switch (depthFormat) {
+			case DepthFormat::Float32: farthest = farthestKey<DepthFloat32>(cell, x1 - x0, y1 - y0); break;
+			case DepthFormat::ReversedFloat32: farthest = farthestKey<DepthReversedFloat32>(cell, x1 - x0, y1 - y0); break;
+			case DepthFormat::Unorm24: farthest = farthestKey<DepthUnorm24>(cell, x1 - x0, y1 - y0); break;
+			case DepthFormat::Unorm16: farthest = farthestKey<DepthUnorm16>(cell, x1 - x0, y1 - y0); break;
+			}
+			hiZ[cell] = farthest;
+			hiZWrites[cell] = 0;
+		}
+		return hiZ[cell];
+	}
+
+	// Draws a pixel at (x, y) with the specified RGB color
+	void draw(int x, int y, unsigned char r, unsigned char g, unsigned char b) {
+		colour[pixelIndex(x, y)] = r | (g << 8) | (b << 16) | (255u << 24);
+	}
+
+	// Draws a packed RGBA8 pixel at (x, y)
+	void draw(int x, int y, unsigned int rgba) { colour[pixelIndex(x, y)] = rgba; }
+
+	// Clear colour to black and depth to the far plane (lazily, see touchCell and packRGB24)
+	void clear() {
+		if (++frameEpoch == 0) {
+			// Wrapped around, make sure no cell looks current
+			std::fill(cellEpoch.begin(), cellEpoch.end(), 0);
+			frameEpoch = 1;
+		}
+	}
+
+	// Hand the finished frame to wherever this target is displayed (if anywhere)
+	virtual void present() = 0;
+};
+
+// Offscreen Render Target (plain in-memory colour + depth of any size, no display needed)
+class OffscreenRenderTarget : public RenderTarget {
+public:
+	// Constructor
+	OffscreenRenderTarget(unsigned int _width, unsigned int _height, DepthFormat _depthFormat = DepthFormat::Float32) {
+		initialize(_width, _height, _depthFormat);
+	}
+
+	// Nothing to display (the RGB24 image is only packed when saved)
+	void present() override {}
+
+	// Write the colour buffer as a binary PPM image
+	bool savePPM(const std::string& filename) const {
+		std::vector<unsigned char> image(static_cast<size_t>(width) * height * 3);
+		packRGB24(image.data());
+
+		std::ofstream file(filename, std::ios::binary);
+		if (!file) return false;
+		file << "P6\n" << width << " " << height << "\n255\n";
+		file.write(reinterpret_cast<const char*>(image.data()), image.size());
+		return file.good();
+	}
+};
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include "Frustum.h"
+#include "MyMath.h"
+
+// Items a BVH leaf holds at most (leaf items are tested box by box)
+const unsigned int BVH_LEAF_SIZE = 4;
+
+// Instance Culling Statistics (summed over frames)
+struct SceneStats {
+	unsigned long long instances = 0;	// Instances in the scene
+	unsigned long long visible = 0;		// Instances whose world bounds touch the frustum
+	unsigned long long occluders = 0;	// Visible instances rasterized into the occlusion buffer
+	unsigned long long occluded = 0;	// Visible instances hidden behind them
+	unsigned long long nodes = 0;		// BVH nodes tested against the frustum
+	unsigned long long refitted = 0;	// BVH nodes refitted after instances moved
+
+	// One line summary, scaled by 1 / frames
+	void print(std::ostream& out, int frames = 1) const {
+		out << "Instances per frame: " << instances / frames << " in the scene, " << visible / frames << " visible, " << occluders / frames << " occluders, "
+			<< occluded / frames << " occluded, " << nodes / frames << " BVH nodes tested, " << refitted / frames << " refitted" << std::endl;
+	}
+};
+
+// Bounding Volume Hierarchy over Instance Bounds
+// Built top-down, each node splits its items at the median of their box centres along the longest axis of those
+// centres, so the tree stays balanced and every subtree owns one contiguous range of the item order. Moving an
+// item only marks the boxes on its path to the root, refit() then rebuilds those boxes bottom-up and keeps the
+// topology (still tight while instances move less than their spacing, rebuild otherwise). Culling walks the
+// tree with a mask of the planes left to test: a node entirely inside the frustum hands out its whole item
+// range without testing anything below it.
+class SceneBVH {
+private:
+	struct Node {
+		AABB bounds;
+		unsigned int first = 0, count = 0;	// Range of order below the node
+		int left = -1, right = -1;			// Children (-1 in a leaf), always stored after their parent
+		int parent = -1;
+		bool dirty = false;					// Bounds need a refit
+	};
+
+	std::vector<Node> nodes;
+	std::vector<unsigned int> order;		// Items in subtree order
+	std::vector<AABB> itemBounds;
+	std::vector<int> leafOf;				// Leaf node of each item
+	bool dirty = false;
+
+	// Node over order[first, first + count) and everything below it
+	int buildNode(unsigned int first, unsigned int count, int parent, const std::vector<Vec3>& centres) {
+		int index = static_cast<int>(nodes.size());
+		nodes.push_back(Node());
+		nodes[index].first = first;
+		nodes[index].count = count;
+		nodes[index].parent = parent;
+		AABB centreBounds;
+		for (unsigned int i = first; i < first + count; i++) {
+			nodes[index].bounds.extend(itemBounds[order[i]]);
+			centreBounds.extend(centres[order[i]]);
+		}
+
+		if (count <= BVH_LEAF_SIZE) {
+			for (unsigned int i = first; i < first + count; i++) leafOf[order[i]] = index;
+			return index;
+		}
+
+		// Median split along the longest axis of the centres
+		Vec3 extent = centreBounds.maximum - centreBounds.minimum;
+		int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+		unsigned int half = count / 2;
+		std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+						 [&](unsigned int a, unsigned int b) { return centres[a].v[axis] < centres[b].v[axis]; });
+		int left = buildNode(first, half, index, centres);
+		int right = buildNode(first + half, count - half, index, centres);
+		nodes[index].left = left;
+		nodes[index].right = right;
+		return index;
+	}
+
+public:
+	// Build over the world bounds of every item (item i is reported as i)
+	void build(const std::vector<AABB>& bounds) {
+		itemBounds = bounds;
+		nodes.clear();
+		order.resize(bounds.size());
+		leafOf.assign(bounds.size(), -1);
+		dirty = false;
+		if (bounds.empty()) return;
+
+		std::vector<Vec3> centres(bounds.size(), Vec3(0.f, 0.f, 0.f));
+		for (size_t i = 0; i < bounds.size(); i++) {
+			order[i] = static_cast<unsigned int>(i);
+			if (!bounds[i].empty()) centres[i] = bounds[i].centre();
+		}
+		nodes.reserve(2 * bounds.size() / BVH_LEAF_SIZE + 1);
+		buildNode(0, static_cast<unsigned int>(bounds.size()), -1, centres);
+	}
+
+	// New world bounds of an item (applied by the next refit)
+	void update(size_t item, const AABB& bounds) {
+		itemBounds[item] = bounds;
+		for (int node = leafOf[item]; node >= 0 && !nodes[node].dirty; node = nodes[node].parent) nodes[node].dirty = true;
+		dirty = true;
+	}
+
+	// Recompute the bounds of every node an update touched (children come after their parent, so walking the nodes
+	// backwards refits them bottom-up), returns how many were refitted
+	size_t refit() {
+		if (!dirty) return 0;
+		dirty = false;
+		size_t refitted = 0;
+		for (size_t i = nodes.size(); i-- > 0;) {
+			Node& node = nodes[i];
+			if (!node.dirty) continue;
+			node.dirty = false;
+			node.bounds = AABB();
+			if (node.left < 0) {
+				for (unsigned int j = node.first; j < node.first + node.count; j++) node.bounds.extend(itemBounds[order[j]]);
+			}
+			else {
+				node.bounds.extend(nodes[node.left].bounds);
+				node.bounds.extend(nodes[node.right].bounds);
+			}
+			refitted++;
+		}
+		return refitted;
+	}
+
+	size_t size() const { return itemBounds.size(); }
+	const AABB& bounds(size_t item) const { return itemBounds[item]; }
+
+	// Call visit(item, inside) for every item whose bounds touch the frustum, in tree order (inside = the bounds are
+	// entirely within it), returns how many nodes were tested
+	template<typename Visit>
+	size_t cull(const Frustum& frustum, Visit&& visit) const {
+		if (nodes.empty()) return 0;
+
+		// The tree is balanced, so the stack never holds more than one entry per level plus one
+		struct Entry {
+			int node;
+			unsigned int mask;
+		};
+		Entry stack[64];
+		int top = 0;
+		stack[top++] = { 0, Frustum::ALL_PLANES };
+		size_t tested = 0;
+		while (top > 0) {
+			Entry entry = stack[--top];
+			const Node& node = nodes[entry.node];
+			if (node.bounds.empty()) continue;
+			tested++;
+			unsigned int mask = entry.mask;
+			Frustum::Overlap overlap = frustum.test(node.bounds, mask);
+			if (overlap == Frustum::Overlap::Outside) continue;
+			if (overlap == Frustum::Overlap::Inside) {
+				for (unsigned int i = node.first; i < node.first + node.count; i++) {
+					if (!itemBounds[order[i]].empty()) visit(order[i], true);
+				}
+				continue;
+			}
+
+			if (node.left >= 0) {
+				stack[top++] = { node.right, mask };
+				stack[top++] = { node.left, mask };
+				continue;
+			}
+			for (unsigned int i = node.first; i < node.first + node.count; i++) {
+				const AABB& box = itemBounds[order[i]];
+				if (box.empty()) continue;
+				unsigned int itemMask = mask;
+				Frustum::Overlap itemOverlap = frustum.test(box, itemMask);
+				if (itemOverlap != Frustum::Overlap::Outside) visit(order[i], itemOverlap == Frustum::Overlap::Inside);
+			}
+		}
+		return tested;
+	}
+};
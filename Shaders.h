@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+
+#include "MyMath.h"
+
+// Shaders
+// A shader is a plain struct the raster pipeline is templated on, so every shading model gets its own fully
+// inlined raster loop without branches or virtual calls per pixel. It provides
+//   static const int VARYINGS                       floats passed from the vertex to the fragment shader
+//   typedef ... Vertex                              per-vertex input
+//   void vertex(const Vertex& in, float* out)       writes the VARYINGS varyings of one vertex
+//   Colour fragment(const Vec4* varyings)           shades one pixel, varying k is varyings[k / 4][k % 4]
+// (varyings are interpolated perspective-correct, see VaryingPlanes)
+
+// Vertex Colour Shader (colours interpolated across the triangle)
+struct VertexColourShader {
+	static const int VARYINGS = 3;
+	typedef Colour Vertex;
+
+	void vertex(const Colour& colour, float* out) const {
+		out[0] = colour.r; out[1] = colour.g; out[2] = colour.b;
+	}
+
+	Colour fragment(const Vec4* varyings) const { return Colour(varyings[0].x, varyings[0].y, varyings[0].z); }
+};
+
+// Lambert Shader (green surface lit by a white directional light plus ambient, from interpolated vertex normals)
+struct LambertShader {
+	static const int VARYINGS = 3;
+	typedef Vec4 Vertex;  // Vertex normal
+
+	void vertex(const Vec4& normal, float* out) const {
+		out[0] = normal.x; out[1] = normal.y; out[2] = normal.z;
+	}
+
+	Colour fragment(const Vec4* varyings) const {
+		static const Vec4 omega_i = Vec4(1.0f, 1.0f, 0.f, 1.f).normalize();  // Light Direction (e.g., Sun from top-right)
+		const Colour rho(0.0f, 1.0f, 0.0f);									// Surface Color (Green Bunny)
+		const Colour L(1.0f, 1.0f, 1.0f);									// Light Intensity (White)
+		const Colour ambient(0.2f, 0.2f, 0.2f);								// Ambient Light (Grey)
+
+		// Surface Normal
+		Vec4 N = Vec4(varyings[0].x, varyings[0].y, varyings[0].z, 0.f).normalize();
+
+		// Lighting = (rho / PI) * (L * max(Dot(omega_i, N), 0) + ambient)
+		return (rho / M_PI) * (L * std::max(Dot(omega_i, N), 0.f) + ambient);
+	}
+};
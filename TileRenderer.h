@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "JobSystem.h"
+#include "MyMath.h"
+#include "Rasterizer.h"
+#include "RenderTarget.h"
+
+// Tile-Based (Sort-Middle) Renderer
+// submit() bins screen-space triangles into fixed-size screen tiles, flush() rasterizes whole tiles as jobs on
+// the job system. Binning can itself run as several jobs, each filling its own bin set: every tile replays the
+// bin sets in order and each bin in submission order, so the output is identical to rasterizing the same
+// triangles one after another over the whole target.
+class TileRenderer {
+public:
+	static const int TILE_SIZE = 64;
+
+private:
+	// Screen-space triangle with its (Lambert) vertex normals
+	struct BinnedTriangle {
+		Triangle t;
+		Vec4 n0, n1, n2;
+	};
+
+	// Triangles one binning job submitted and its per-tile triangle indices, in submission order
+	struct BinSet {
+		std::vector<BinnedTriangle> triangles;
+		std::vector<std::vector<unsigned int>> bins;
+	};
+
+	JobSystem& jobs;
+	RenderTarget* target = nullptr;
+	int tilesX = 0;
+	int tilesY = 0;
+	std::vector<BinSet> binSets;  // Kept across frames so the bins keep their capacity
+	size_t binSetCount = 0;		  // Bin sets in use this frame
+
+	// Bounds of a tile, clamped to the target
+	PixelRect tileRect(int tile) const {
+		int tx = tile % tilesX;
+		int ty = tile / tilesX;
+		return { tx * TILE_SIZE, ty * TILE_SIZE,
+				 std::min((tx + 1) * TILE_SIZE, static_cast<int>(target->getWidth())) - 1,
+				 std::min((ty + 1) * TILE_SIZE, static_cast<int>(target->getHeight())) - 1 };
+	}
+
+	// Replay every bin of one tile
+	void rasterizeTile(int tile) {
+		PixelRect clip = tileRect(tile);
+		for (size_t set = 0; set < binSetCount; set++) {
+			const BinSet& binSet = binSets[set];
+			for (unsigned int index : binSet.bins[tile]) {
+				const BinnedTriangle& b = binSet.triangles[index];
+				rasterizeTriangle(*target, b.t, b.n0, b.n1, b.n2, clip);
+			}
+		}
+	}
+
+public:
+	// Constructor (tiles are rasterized on the given job system)
+	TileRenderer(JobSystem& _jobs) : jobs(_jobs) {}
+
+	TileRenderer(const TileRenderer&) = delete;
+	TileRenderer& operator=(const TileRenderer&) = delete;
+
+	// Start binning a frame for the given target, with sets independent binning jobs (set 0..sets - 1)
+	void begin(RenderTarget& _target, size_t sets = 1) {
+		target = &_target;
+		tilesX = (target->getWidth() + TILE_SIZE - 1) / TILE_SIZE;
+		tilesY = (target->getHeight() + TILE_SIZE - 1) / TILE_SIZE;
+		binSetCount = sets;
+		if (binSets.size() < sets) binSets.resize(sets);
+		for (size_t set = 0; set < sets; set++) {
+			BinSet& binSet = binSets[set];
+			binSet.triangles.clear();
+			binSet.bins.resize(tilesX * tilesY);
+			for (std::vector<unsigned int>& bin : binSet.bins) bin.clear();
+		}
+	}
+
+	// Bin a screen-space triangle into every tile its bounding box overlaps (each bin set must only be filled
+	// by one thread at a time)
+	void submit(const Triangle& t, const Vec4& n0, const Vec4& n1, const Vec4& n2, size_t set = 0) {
+		Vec4 tr, bl;
+		findBounds(*target, t.v0, t.v1, t.v2, tr, bl);
+		PixelRect bounds = target->getBounds();
+		if (!(tr.x >= bounds.minX && tr.y >= bounds.minY && bl.x < bounds.maxX + 1 && bl.y < bounds.maxY + 1)) return;  // Entirely off screen (or NaN)
+
+		BinSet& binSet = binSets[set];
+		unsigned int index = static_cast<unsigned int>(binSet.triangles.size());
+		binSet.triangles.push_back({ t, n0, n1, n2 });
+
+		int tx0 = static_cast<int>(bl.x) / TILE_SIZE, tx1 = static_cast<int>(tr.x) / TILE_SIZE;
+		int ty0 = static_cast<int>(bl.y) / TILE_SIZE, ty1 = static_cast<int>(tr.y) / TILE_SIZE;
+		for (int ty = ty0; ty <= ty1; ty++)
+			for (int tx = tx0; tx <= tx1; tx++)
+				binSet.bins[ty * tilesX + tx].push_back(index);
+	}
+
+	// Rasterize all binned tiles as jobs and wait for them to finish (a tile covers whole Hi-Z cells, so no two
+	// jobs ever touch the same pixels)
+	void flush() {
+		jobs.parallelFor(0, static_cast<size_t>(tilesX * tilesY), 1, [&](size_t begin, size_t end) {
+			for (size_t tile = begin; tile < end; tile++) rasterizeTile(static_cast<int>(tile));
+		});
+	}
+};
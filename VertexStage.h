@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "MyMath.h"
+#include "RasterKernel.h"
+#include "RenderTarget.h"
+
+// Vertex Position Streams (structure of arrays, one stream per component so SIMD lanes load whole registers)
+struct VertexStreams {
+	std::vector<float> x, y, z;
+
+	void clear() { x.clear(); y.clear(); z.clear(); }
+	void reserve(size_t count) { x.reserve(count); y.reserve(count); z.reserve(count); }
+	void push(float _x, float _y, float _z) { x.push_back(_x); y.push_back(_y); z.push_back(_z); }
+	size_t size() const { return x.size(); }
+};
+
+// Post-Transform Vertex Buffer (one entry per stream vertex, read through the index buffer)
+struct TransformedVertices {
+	std::vector<Vec4> clip;		 // Clip space, before the divide (primitive assembly clips and culls on these)
+	std::vector<Vec4> screen;	 // Pixels (y down), NDC z and 1/w, exactly what PrimitiveAssembler's toScreen gives
+};
+
+// Batch Vertex Stage
+// Transforms position streams by a model-view-projection matrix (w = 1) and, in the same pass, divides by w
+// and maps to the viewport. The SSE and AVX2 paths handle 4 and 8 vertices per step with the same operation
+// order as Matrix::mul and the scalar viewport transform, so every path produces identical bits. The active
+// raster kernel type picks the path.
+class VertexStage {
+private:
+	float m[16];
+	float width = 0.f;
+	float height = 0.f;
+
+	// The paths transform vertices [begin, end) of the streams into clip and screen, which point at the entry for
+	// vertex begin
+
+	// Scalar reference (also handles the tail the SIMD paths leave)
+	void transformScalar(const VertexStreams& in, size_t begin, size_t end, Vec4* clip, Vec4* screen) const {
+		for (size_t i = begin; i < end; i++) {
+			float x = in.x[i], y = in.y[i], z = in.z[i];
+			float cx = x * m[0] + y * m[1] + z * m[2] + m[3];
+			float cy = x * m[4] + y * m[5] + z * m[6] + m[7];
+			float cz = x * m[8] + y * m[9] + z * m[10] + m[11];
+			float cw = x * m[12] + y * m[13] + z * m[14] + m[15];
+			clip[i - begin] = Vec4(cx, cy, cz, cw);
+
+			float W = 1.f / cw;
+			float screenX = (cx * W + 1.0f) * 0.5f * width;
+			float screenY = (1.f - (cy * W + 1.0f) * 0.5f) * height;
+			screen[i - begin] = Vec4(screenX, screenY, cz * W, W);
+		}
+	}
+
+#ifdef RASTER_X86
+	// SSE Path (4 vertices per step)
+	size_t transformSSE(const VertexStreams& in, size_t begin, size_t end, Vec4* clip, Vec4* screen) const {
+		__m128 one = _mm_set1_ps(1.f), half = _mm_set1_ps(0.5f);
+		__m128 w = _mm_set1_ps(width), h = _mm_set1_ps(height);
+		size_t i = begin;
+		for (; i + 4 <= end; i += 4) {
+			__m128 x = _mm_loadu_ps(&in.x[i]), y = _mm_loadu_ps(&in.y[i]), z = _mm_loadu_ps(&in.z[i]);
+			__m128 row[4];
+			for (int r = 0; r < 4; r++)
+				row[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[r * 4])), _mm_mul_ps(y, _mm_set1_ps(m[r * 4 + 1]))),
+											   _mm_mul_ps(z, _mm_set1_ps(m[r * 4 + 2]))), _mm_set1_ps(m[r * 4 + 3]));
+
+			__m128 W = _mm_div_ps(one, row[3]);
+			__m128 sx = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(row[0], W), one), half), w);
+			__m128 sy = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(row[1], W), one), half)), h);
+			__m128 sz = _mm_mul_ps(row[2], W);
+
+			// Back to one Vec4 per vertex
+			_MM_TRANSPOSE4_PS(row[0], row[1], row[2], row[3]);
+			_MM_TRANSPOSE4_PS(sx, sy, sz, W);
+			float* c = clip[i - begin].v;
+			float* s = screen[i - begin].v;
+			for (int r = 0; r < 4; r++) _mm_storeu_ps(c + r * 4, row[r]);
+			_mm_storeu_ps(s, sx); _mm_storeu_ps(s + 4, sy); _mm_storeu_ps(s + 8, sz); _mm_storeu_ps(s + 12, W);
+		}
+		return i;
+	}
+
+	// Eight lanes of x, y, z, w to eight consecutive Vec4s
+	RASTER_TARGET_AVX2 static void storeTransposed(float* out, __m256 x, __m256 y, __m256 z, __m256 w) {
+		__m256 xy0 = _mm256_unpacklo_ps(x, y), xy1 = _mm256_unpackhi_ps(x, y);
+		__m256 zw0 = _mm256_unpacklo_ps(z, w), zw1 = _mm256_unpackhi_ps(z, w);
+		__m256 v04 = _mm256_shuffle_ps(xy0, zw0, 0x44), v15 = _mm256_shuffle_ps(xy0, zw0, 0xEE);
+		__m256 v26 = _mm256_shuffle_ps(xy1, zw1, 0x44), v37 = _mm256_shuffle_ps(xy1, zw1, 0xEE);
+		_mm256_storeu_ps(out, _mm256_permute2f128_ps(v04, v15, 0x20));
+		_mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(v26, v37, 0x20));
+		_mm256_storeu_ps(out + 16, _mm256_permute2f128_ps(v04, v15, 0x31));
+		_mm256_storeu_ps(out + 24, _mm256_permute2f128_ps(v26, v37, 0x31));
+	}
+
+	// AVX2 Path (8 vertices per step)
+	RASTER_TARGET_AVX2 size_t transformAVX2(const VertexStreams& in, size_t begin, size_t end, Vec4* clip, Vec4* screen) const {
+		__m256 one = _mm256_set1_ps(1.f), half = _mm256_set1_ps(0.5f);
+		__m256 w = _mm256_set1_ps(width), h = _mm256_set1_ps(height);
+		size_t i = begin;
+		for (; i + 8 <= end; i += 8) {
+			__m256 x = _mm256_loadu_ps(&in.x[i]), y = _mm256_loadu_ps(&in.y[i]), z = _mm256_loadu_ps(&in.z[i]);
+			__m256 row[4];
+			for (int r = 0; r < 4; r++)
+				row[r] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(m[r * 4])), _mm256_mul_ps(y, _mm256_set1_ps(m[r * 4 + 1]))),
+												 _mm256_mul_ps(z, _mm256_set1_ps(m[r * 4 + 2]))), _mm256_set1_ps(m[r * 4 + 3]));
+
+			__m256 W = _mm256_div_ps(one, row[3]);
+			__m256 sx = _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(row[0], W), one), half), w);
+			__m256 sy = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(row[1], W), one), half)), h);
+			__m256 sz = _mm256_mul_ps(row[2], W);
+
+			storeTransposed(clip[i - begin].v, row[0], row[1], row[2], row[3]);
+			storeTransposed(screen[i - begin].v, sx, sy, sz, W);
+		}
+		return i;
+	}
+#endif
+
+	// Transform vertices [begin, end) with the active kernel's path
+	void transformRange(const VertexStreams& in, size_t begin, size_t end, Vec4* clip, Vec4* screen) const {
+		size_t done = begin;
+#ifdef RASTER_X86
+		switch (activeRasterKernelType()) {
+		case RasterKernelType::AVX2: done = transformAVX2(in, begin, end, clip, screen); break;
+		case RasterKernelType::SSE: done = transformSSE(in, begin, end, clip, screen); break;
+		default: break;
+		}
+#endif
+		transformScalar(in, done, end, clip + (done - begin), screen + (done - begin));
+	}
+
+public:
+	// Constructors (mvp maps object space to clip space, the viewport is the target's full size or width x height)
+	VertexStage(const Matrix& mvp, float _width, float _height) : width(_width), height(_height) {
+		for (int i = 0; i < 16; i++) m[i] = mvp.m[i];
+	}
+
+	VertexStage(const Matrix& mvp, const RenderTarget& target)
+		: VertexStage(mvp, static_cast<float>(target.getWidth()), static_cast<float>(target.getHeight())) {}
+
+	// Transform every vertex of the streams into the post-transform buffer
+	void transform(const VertexStreams& in, TransformedVertices& out) const {
+		out.clip.resize(in.size());
+		out.screen.resize(in.size());
+		transformRange(in, 0, in.size(), out.clip.data(), out.screen.data());
+	}
+
+	// Transform vertices [begin, end) of the streams into clip[0, end - begin) and screen[0, end - begin) (e.g. the
+	// vertices of one meshlet into a small scratch buffer)
+	void transform(const VertexStreams& in, size_t begin, size_t end, Vec4* clip, Vec4* screen) const {
+		transformRange(in, begin, end, clip, screen);
+	}
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "JobSystem.h"
+#include "MyMath.h"
+#include "RasterKernel.h"
+#include "Rasterizer.h"
+#include "RenderTarget.h"
+
+// ID of pixels no triangle covers
+const unsigned int NO_TRIANGLE = 0xFFFFFFFFu;
+
+// Visibility Buffer (Deferred) Renderer
+// submit() rasterizes depth plus the index of the triangle that won each pixel, nothing is shaded.
+// resolve() then runs the Lambert fragment shader on every covered pixel exactly once, with the stored
+// triangle's varying planes, so the cost of shading follows the resolution instead of the depth
+// complexity. The image is identical to shading every fragment as it passes the depth test. The plane
+// setup and the shading of bands of rows run as jobs on the job system.
+class VisibilityBuffer {
+private:
+	// Screen-space triangle with its (Lambert) vertex normals
+	struct VisibleTriangle {
+		Triangle t;
+		Vec4 n0, n1, n2;
+	};
+
+	JobSystem& jobs;
+	RenderTarget* target = nullptr;
+	std::vector<unsigned int> ids;			  // Triangle index per pixel (NO_TRIANGLE = background)
+	unsigned int idWidth = 0;				  // Row length of ids
+	std::vector<VisibleTriangle> triangles;	  // Triangles submitted this frame
+	PixelRect touched = { 0, 0, -1, -1 };	  // Bounds of every triangle submitted this frame (only these IDs are ever set)
+
+	// Varying planes of the triangles that are visible, built during resolve()
+	std::vector<int> setupSlot;				  // Index into planes per triangle (-1 = not visible)
+	std::vector<unsigned int> visible;		  // Triangle of each planes entry
+	std::vector<VaryingPlanes<LambertShader::VARYINGS>> planes;
+	LambertShader shader;
+
+	// Shade the visible pixels of rows [y0, y1)
+	void shadeRows(int y0, int y1) {
+		int width = target->getWidth();
+		unsigned int* colour = target->colourBuffer();
+		for (int y = y0; y < y1; y++) {
+			const unsigned int* idRow = &ids[static_cast<size_t>(y) * width];
+
+			// One tile row (8 pixels, contiguous in the target) at a time, so the colours are packed together
+			for (int tileX = touched.minX & ~(HIZ_CELL_SIZE - 1); tileX <= touched.maxX; tileX += HIZ_CELL_SIZE) {
+				Colour colours[HIZ_CELL_SIZE];
+				unsigned int mask = 0;
+				int x0 = std::max(tileX, touched.minX), x1 = std::min(tileX + HIZ_CELL_SIZE - 1, touched.maxX);
+				for (int x = x0; x <= x1; x++) {
+					unsigned int id = idRow[x];
+					if (id == NO_TRIANGLE) continue;
+
+					// Same planes (and so the same varyings) the forward rasterizer interpolates at this pixel
+					Vec4 varyings[VaryingPlanes<LambertShader::VARYINGS>::GROUPS];
+					planes[setupSlot[id]].interpolate(x, y, varyings);
+					colours[x - tileX] = shader.fragment(varyings);
+					mask |= 1u << (x - tileX);
+				}
+				if (!mask) continue;
+
+				unsigned int packed[HIZ_CELL_SIZE];
+				packRGBA8(colours, packed, HIZ_CELL_SIZE);
+				unsigned int* row = colour + target->pixelIndex(tileX, y);
+				for (; mask; mask &= mask - 1) {
+					int i = lowestBit(mask);
+					row[i] = packed[i];
+				}
+			}
+		}
+	}
+
+public:
+	// Constructor (resolve runs on the given job system)
+	VisibilityBuffer(JobSystem& _jobs) : jobs(_jobs) {}
+
+	// Start a frame for the given target (its depth must already be cleared). The IDs do not depend on which
+	// target they resolve into, so alternating double-buffered targets of one size keep the partial reset.
+	void begin(RenderTarget& _target) {
+		size_t size = static_cast<size_t>(_target.getWidth()) * _target.getHeight();
+		if (idWidth != _target.getWidth() || ids.size() != size) {
+			ids.assign(size, NO_TRIANGLE);
+			idWidth = _target.getWidth();
+		}
+		else {
+			// Only the last frame's triangles wrote IDs
+			for (int y = touched.minY; y <= touched.maxY; y++) {
+				unsigned int* row = &ids[static_cast<size_t>(y) * idWidth];
+				std::fill(row + touched.minX, row + touched.maxX + 1, NO_TRIANGLE);
+			}
+		}
+		target = &_target;
+		triangles.clear();
+		touched = { target->getBounds().maxX + 1, target->getBounds().maxY + 1, -1, -1 };
+	}
+
+	// Rasterize a screen-space triangle into the depth and ID buffers
+	void submit(const Triangle& t, const Vec4& n0, const Vec4& n1, const Vec4& n2) {
+		Vec4 tr, bl;
+		findBounds(*target, t.v0, t.v1, t.v2, tr, bl);
+		PixelRect bounds = target->getBounds();
+		if (!(tr.x >= bounds.minX && tr.y >= bounds.minY && bl.x < bounds.maxX + 1 && bl.y < bounds.maxY + 1)) return;  // Entirely off screen (or NaN)
+		touched.minX = std::min(touched.minX, static_cast<int>(bl.x));
+		touched.minY = std::min(touched.minY, static_cast<int>(bl.y));
+		touched.maxX = std::max(touched.maxX, static_cast<int>(tr.x));
+		touched.maxY = std::max(touched.maxY, static_cast<int>(tr.y));
+
+		unsigned int index = static_cast<unsigned int>(triangles.size());
+		triangles.push_back({ t, n0, n1, n2 });
+
+		unsigned int* idRows = ids.data();
+		int width = target->getWidth();
+		traverseTriangle(*target, t, target->getBounds(), [&](int x, int y, float, float, float) {
+			idRows[y * width + x] = index;
+		});
+	}
+
+	// Shade every visible pixel once
+	void resolve() {
+		// Triangles that won at least one pixel get a planes slot, in the order they are first seen
+		setupSlot.assign(triangles.size(), -1);
+		visible.clear();
+		int width = target->getWidth();
+		for (int y = touched.minY; y <= touched.maxY; y++) {
+			const unsigned int* idRow = &ids[static_cast<size_t>(y) * width];
+			for (int x = touched.minX; x <= touched.maxX; x++) {
+				unsigned int id = idRow[x];
+				if (id != NO_TRIANGLE && setupSlot[id] < 0) {
+					setupSlot[id] = static_cast<int>(visible.size());
+					visible.push_back(id);
+				}
+			}
+		}
+
+		// Set up their planes, then shade bands of rows
+		PixelRect bounds = target->getBounds();
+		planes.resize(visible.size());
+		jobs.parallelFor(0, visible.size(), 64, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				const VisibleTriangle& v = triangles[visible[i]];
+				planes[i] = setupVaryings(shader, TriangleSetup(v.t, bounds), v.t, v.n0, v.n1, v.n2);
+			}
+		});
+		if (touched.minY > touched.maxY) return;
+		jobs.parallelFor(touched.minY, touched.maxY + 1, HIZ_CELL_SIZE, [&](size_t begin, size_t end) {
+			shadeRows(static_cast<int>(begin), static_cast<int>(end));
+		});
+	}
+
+	// Triangle index that covers (x, y) after the last submit (NO_TRIANGLE for background)
+	unsigned int triangleAt(int x, int y) const { return ids[static_cast<size_t>(y) * target->getWidth() + x]; }
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "GamesEngineeringBase.h"
+#include "RenderTarget.h"
+
+// Window Render Target (presents into the back buffer of a GamesEngineeringBase::Window)
+class WindowRenderTarget : public RenderTarget {
+private:
+	GamesEngineeringBase::Window& canvas;
+
+public:
+	// Constructor (window must already be created)
+	WindowRenderTarget(GamesEngineeringBase::Window& _canvas, DepthFormat _depthFormat = DepthFormat::Float32) : canvas(_canvas) {
+		initialize(canvas.getWidth(), canvas.getHeight(), _depthFormat);
+	}
+
+	// Pack the frame into the (RGB24) back buffer, present it and pump window messages
+	void present() override {
+		packRGB24(canvas.backBuffer());
+		canvas.present();
+	}
+
+	// Underlying window (input handling)
+	GamesEngineeringBase::Window& window() { return canvas; }
+};
@@ -1,187 +1,359 @@
 #include "MyMath.h"
+#include "FramePipeline.h"
 #include "GEMLoader.h"
+#include "JobSystem.h"
+#include "MeshOptimizer.h"
+#include "Meshlet.h"
+#include "OcclusionBuffer.h"
+#include "RenderTarget.h"
+#include "Rasterizer.h"
+#include "PrimitiveAssembly.h"
+#include "SceneBVH.h"
+#include "TileRenderer.h"
+#include "VertexStage.h"
+#include "VisibilityBuffer.h"
+#include <cfloat>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
+#ifdef _WIN32
+#include "WindowRenderTarget.h"
+#endif
+
 const unsigned int WINDOW_WIDTH = 1024;
 const unsigned int WINDOW_HEIGHT = 768;
 
-void rasterizeTriangle(GamesEngineeringBase::Window& canvas, const Triangle& t, std::vector<float> &zBuffer);
-void rasterizeTriangle(GamesEngineeringBase::Window& canvas, const Triangle& t, const Vec4& n0, const Vec4& n1, const Vec4& n2, std::vector<float> &zBuffer);
-void renderLesson1_2D(GamesEngineeringBase::Window& canvas, std::vector<float> &zBuffer);
-void renderLesson2_Projection(GamesEngineeringBase::Window& canvas, Matrix& projMatrix, Matrix& viewMatrix, std::vector<float> &zBuffer);
-void renderBunny(GamesEngineeringBase::Window& canvas, Matrix& viewProj, const std::vector<Vec3>& vertices, const std::vector<Vec3>& normals, std::vector<float>& zBuffer);
+// Indexed mesh as drawn (positions split into SIMD streams at load time, normals and indices as in the GEM mesh),
+// and the same triangles split into meshlets, each with its own copy of the vertices it uses
+struct DrawMesh {
+	VertexStreams positions;
+	std::vector<Vec4> normals;
+	std::vector<unsigned int> indices;
+	std::vector<int> edgeNeighbours;			  // Triangle across each edge (buildEdgeNeighbours), for occlusion culling
+
+	std::vector<Meshlet> meshlets;
+	VertexStreams meshletPositions;				  // Vertices of every meshlet, in meshlet order
+	std::vector<Vec4> meshletNormals;
+	std::vector<unsigned char> meshletTriangles;  // Three meshlet-local corners per triangle
+};
+
+// Model drawn by any number of instances (its meshes and their bounds in model space)
+struct SceneModel {
+	std::string filename;
+	std::vector<DrawMesh> meshes;
+	AABB bounds;
+};
+
+// Placed model (animated instances spin about their own y-axis on top of their placement)
+struct SceneInstance {
+	size_t model = 0;
+	Transform placement;
+	Transform world;
+	bool animated = false;
+};
+
+// Models, their instances and a BVH over the instances' world bounds
+struct Scene {
+	std::vector<SceneModel> models;
+	std::vector<SceneInstance> instances;
+	SceneBVH bvh;
+};
+
+// Spacing of the procedural instance grid (a bunny is about 0.16 wide) and how often one of its instances spins
+const float INSTANCE_SPACING = 0.25f;
+const size_t ANIMATED_INSTANCE_STRIDE = 16;
+
+// Resolution and number of views (the six axis directions) the load-time overdraw estimate renders
+const unsigned int OVERDRAW_VIEW_SIZE = 256;
+const int OVERDRAW_VIEWS = 6;
+
+// Meshlets per geometry job (about a thousand triangles)
+const size_t MESHLET_BATCH = 8;
+
+// Visible instances rasterized into the occlusion buffer at most, and how large they must look (bounding radius
+// over distance from the eye, 0.1 spans about a quarter of the screen height with the 45 degree projection)
+const size_t OCCLUDER_INSTANCES = 8;
+const float OCCLUDER_MIN_SIZE = 0.1f;
+
+// Bin sets the tiled mode fills per job system thread (each binning job takes a contiguous run of batches)
+const size_t BIN_SETS_PER_THREAD = 4;
+
+// Instance that passed frustum culling this frame
+struct VisibleInstance {
+	size_t instance;
+	bool inside;			// World bounds entirely inside the frustum
+	bool occluder;			// Rasterized into the occlusion buffer (never tested against it)
+};
+
+// Mesh of a visible instance as the geometry stage draws it this frame (the culler, vertex stage and occlusion
+// tests work in the model space of the instance)
+struct SceneDraw {
+	const DrawMesh* mesh;
+	Transform world;		// Inverse already cached, so jobs only read it
+	bool identity;			// Normals need no transform
+	bool inside;			// Instance bounds entirely inside the frustum, its meshlets skip the frustum test
+	size_t firstBatch;
+	Matrix mvp;
+	VertexStage vertexStage;
+	MeshletCuller culler;
+};
+
+// Screen-space triangle with its (Lambert) vertex normals, as primitive assembly hands it to rasterization
+struct AssembledTriangle {
+	Triangle t;
+	Vec4 n0, n1, n2;
+};
+
+// One frame as the geometry stage leaves it for the raster stage (the mode, the camera and the scene's assembled
+// triangles, one list per assembly batch, in submission order)
+struct FrameGeometry {
+	int mode = 2;
+	Matrix view;
+	std::vector<std::vector<AssembledTriangle>> batches;  // Kept across frames so the lists keep their capacity
+	size_t batchCount = 0;								  // Batches in use this frame
+};
+
+// State shared by every frame of a run (job system, renderers and statistics, the geometry stage only uses
+// draws and the statistics, the raster stage only the renderers)
+struct FrameContext {
+	JobSystem jobs;
+	TileRenderer tiles;
+	VisibilityBuffer visibility;
+	CullMode cullMode = CullMode::Back;
+	bool meshletCulling = true;		  // Cull whole meshlets before their vertices are transformed
+	bool occlusionCulling = true;	  // Cull instances and meshlets hidden behind the largest visible instances
+	PrimitiveStats primitives;
+	SceneStats sceneStats;
+	OcclusionBuffer occlusion;
+	std::vector<VisibleInstance> visible;	 // Instances that passed frustum culling this frame, in BVH order
+	std::vector<SceneDraw> draws;			 // Meshes of the visible instances this frame
+	std::vector<PrimitiveStats> batchStats;  // Statistics of each geometry job, summed after the frame
+
+	// Constructor (threads = 0 uses one per hardware thread)
+	FrameContext(unsigned int threads = 0) : jobs(threads), tiles(jobs), visibility(jobs) {}
+};
+
+void renderLesson1_2D(RenderTarget& target);
+void renderLesson2_Projection(RenderTarget& target, Matrix& projMatrix, Matrix& viewMatrix);
+std::vector<DrawMesh> makeDrawMeshes(const std::vector<GEMLoader::GEMMesh>& gemMeshes);
+void buildDrawMeshlets(const GEMLoader::GEMMesh& gemMesh, DrawMesh& mesh);
+float measureOverdraw(const std::vector<DrawMesh>& meshes);
+SceneModel loadModel(const std::string& filename, bool optimizeMeshes);
+bool loadScene(const std::string& filename, bool optimizeMeshes, Scene& scene);
+void makeInstanceGrid(const std::string& filename, size_t count, bool optimizeMeshes, Scene& scene);
+void animateScene(Scene& scene, float time, FrameContext& context);
+void assembleScene(const RenderTarget& target, const Matrix& viewProj, const Vec3& eye, const Scene& scene, FrameContext& context, FrameGeometry& geometry);
+void rasterizeScene(RenderTarget& target, const FrameGeometry& geometry, FrameContext& context, TileRenderer* tiles = nullptr, VisibilityBuffer* visibility = nullptr);
+void buildFrame(const RenderTarget& target, Matrix& proj, int mode, float time, Scene& scene, FrameContext& context, FrameGeometry& geometry);
+void rasterizeFrame(RenderTarget& target, Matrix& proj, FrameGeometry& geometry, FrameContext& context);
+int runHeadless(int frames, int mode, unsigned int width, unsigned int height, const std::string& output, Scene& scene, CullMode cullMode, DepthFormat depthFormat, unsigned int threads, unsigned int latency, bool meshletCulling, bool occlusionCulling);
 
 int main(int argc, char** argv) {
+	// Command Line (--headless [frames] renders offscreen, --size W H, --output file.ppm, --tiled and --deferred
+	// configure it, --kernel scalar|sse|avx2 overrides the detected raster kernel, --cull back|front|none the culling,
+	// --depth float|reversed|unorm24|unorm16 the depth buffer format, --threads N the job system size, --latency N
+	// the frames in flight, --no-mesh-opt keeps the triangle and vertex order of the file, --no-meshlet-cull draws
+	// every meshlet, --no-occlusion-cull skips the occlusion buffer, --scene file.json loads a GEM scene and
+	// --instances N draws a grid of N bunnies instead)
+	int headlessFrames = 0;
+	int headlessMode = 2;
+	unsigned int width = WINDOW_WIDTH, height = WINDOW_HEIGHT;
+	std::string output = "frame.ppm";
+	CullMode cullMode = CullMode::Back;
+	DepthFormat depthFormat = DepthFormat::Float32;
+	unsigned int threads = 0;
+	unsigned int latency = 2;
+	bool optimizeMeshes = true;
+	bool meshletCulling = true;
+	bool occlusionCulling = true;
+	std::string sceneFile;
+	size_t instances = 1;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--headless") headlessFrames = (i + 1 < argc && argv[i + 1][0] != '-') ? std::atoi(argv[++i]) : 100;
+		else if (arg == "--size" && i + 2 < argc) { width = std::atoi(argv[++i]); height = std::atoi(argv[++i]); }
+		else if (arg == "--output" && i + 1 < argc) output = argv[++i];
+		else if (arg == "--tiled") headlessMode = 3;
+		else if (arg == "--deferred") headlessMode = 4;
+		else if (arg == "--cull" && i + 1 < argc) {
+			std::string mode = argv[++i];
+			cullMode = (mode == "none") ? CullMode::None : (mode == "front") ? CullMode::Front : CullMode::Back;
+		}
+		else if (arg == "--kernel" && i + 1 < argc && !setRasterKernel(argv[++i])) std::cout << "Raster kernel " << argv[i] << " is not supported, using " << rasterKernelName() << std::endl;
+		else if (arg == "--depth" && i + 1 < argc && !parseDepthFormat(argv[++i], depthFormat)) std::cout << "Unknown depth format " << argv[i] << ", using " << depthFormatName(depthFormat) << std::endl;
+		else if (arg == "--threads" && i + 1 < argc) threads = std::atoi(argv[++i]);
+		else if (arg == "--latency" && i + 1 < argc) latency = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "--no-mesh-opt") optimizeMeshes = false;
+		else if (arg == "--no-meshlet-cull") meshletCulling = false;
+		else if (arg == "--no-occlusion-cull") occlusionCulling = false;
+		else if (arg == "--scene" && i + 1 < argc) sceneFile = argv[++i];
+		else if (arg == "--instances" && i + 1 < argc) instances = std::max(1, std::atoi(argv[++i]));
+	}
+#ifndef _WIN32
+	// No window outside of Windows, always render headless
+	if (headlessFrames == 0) headlessFrames = 100;
+#endif
+
+	// Load the Scene (a GEM scene file, or a grid of bunny instances, a single one at the origin by default)
+	Scene scene;
+	if (sceneFile.empty()) makeInstanceGrid("Resources/bunny.gem", instances, optimizeMeshes, scene);
+	else if (!loadScene(sceneFile, optimizeMeshes, scene)) {
+		std::cout << "Failed to load scene " << sceneFile << std::endl;
+		return 1;
+	}
+
+	if (headlessFrames > 0) return runHeadless(headlessFrames, headlessMode, width, height, output, scene, cullMode, depthFormat, threads, latency, meshletCulling, occlusionCulling);
+
+#ifdef _WIN32
 	// Initialization (load timer object and create a canvas)
 	GamesEngineeringBase::Timer timer;
 	GamesEngineeringBase::Window canvas;
 	canvas.create(WINDOW_WIDTH, WINDOW_HEIGHT, "Rasterizer");
+	FrameContext context(threads);
+	context.cullMode = cullMode;
+	context.meshletCulling = meshletCulling;
+	context.occlusionCulling = occlusionCulling;
+
+	// One window target per frame in flight (double-buffered colour and depth by default)
+	std::vector<std::unique_ptr<WindowRenderTarget>> targets;
+	std::vector<RenderTarget*> targetPointers;
+	for (unsigned int i = 0; i < latency; i++) {
+		targets.emplace_back(new WindowRenderTarget(canvas, depthFormat));
+		targetPointers.push_back(targets.back().get());
+	}
 
-	// Load Bunny Model Meshes and Push Vertex to Vertex List
-	std::vector<GEMLoader::GEMMesh> meshes;
-	GEMLoader::GEMModelLoader loader;
-	loader.load("Resources/bunny.gem", meshes);
-
-	std::vector<Vec3> vertexList;
-	std::vector<Vec3> normalList;
-
-	for (int i = 0; i < meshes.size(); i++) {
-		for (int j = 0; j < meshes[i].indices.size(); j++) {
-			GEMLoader::GEMVec3 vec;
-			GEMLoader::GEMVec3 norm;
+	// Projection Matrix (zFar = 100, zNear = 0.1, theta = 45 degrees)
+	Matrix proj = Matrix::projection(*targets[0], 100.0f, 0.1f, 45.f);
 
-			int index = meshes[i].indices[j];
-			vec = meshes[i].verticesStatic[index].position;
-			norm = meshes[i].verticesStatic[index].normal;
+	// Frame Pipeline (geometry on this thread, rasterization on the raster thread, present back on this thread)
+	FramePipeline<FrameGeometry> pipeline(context.jobs, targetPointers, [&](FrameGeometry& geometry, RenderTarget& target) {
+		target.clear();  // Clear the colour and z-Buffer
+		rasterizeFrame(target, proj, geometry, context);
+	});
+	auto present = [](RenderTarget& target) { target.present(); };  // Display a finished frame on the canvas
 
-			vertexList.push_back(Vec3(vec.x, vec.y, vec.z));
-			normalList.push_back(Vec3(norm.x, norm.y, norm.z));
-		}
-	}
-
-	// z-Buffer and projection Matrix (zFar = 100, zNear = 0.1, theta = 45 degrees)
-	std::vector<float> zBuffer(WINDOW_WIDTH * WINDOW_HEIGHT, 1.f);
-	Matrix proj = Matrix::projection(canvas, 100.0f, 0.1f, 45.f);
-	
 	// Mode Selection for 2D, 3D or Bunny Rendering and total time variable
 	float time = 0.f;
 	int currentMode = 2;  // Render Bunny by default
 
 	// Main Loop
 	while (true) {
-		time += timer.dt();								  // Calculate time
-		canvas.clear();									  // Clear the canvas
-		std::fill(zBuffer.begin(), zBuffer.end(), 1.0f);  // Reset z-Buffer
+		time += timer.dt();  // Calculate time
 
 		// Input Handling
 		if (canvas.keyPressed(VK_ESCAPE)) break;
 		if (canvas.keyPressed('1')) currentMode = 0; // 2D Triangle
 		if (canvas.keyPressed('2')) currentMode = 1; // 3D Projection
 		if (canvas.keyPressed('3')) currentMode = 2; // Spinning Bunny
+		if (canvas.keyPressed('4')) currentMode = 3; // Spinning Bunny (Tiled, Multithreaded)
+		if (canvas.keyPressed('5')) currentMode = 4; // Spinning Bunny (Visibility Buffer, Deferred Shading)
 
-		Matrix view;
-		if (currentMode == 2) {
-			// Spinning Camera
-			float radius = 0.5f;
-			float camX = radius * cos(time);
-			float camZ = radius * sin(time);
-			view = Matrix::lookAt(Vec3(camX, 0.f, camZ), Vec3(0.f, 0.f, 0.f), Vec3(0.f, 1.f, 0.f));  // Look from (camX, 0, camZ) -> to Origin (0,0,0)
-		}
-		else view = Matrix::lookAt(Vec3(0.f, 0.f, 5.f), Vec3(0.f, 0.f, 0.f), Vec3(0.f, 1.f, 0.f));   // Static Camera
-
-		// Render Logic
-		if (currentMode == 0) renderLesson1_2D(canvas, zBuffer);
-		else if (currentMode == 1) renderLesson2_Projection(canvas, proj, view, zBuffer);
-		else if (currentMode == 2) {
-			Matrix viewProj = proj * view;
-			renderBunny(canvas, viewProj, vertexList, normalList, zBuffer);
-		}
-		// Display the current frame on the canvas
-		canvas.present();
+		// Render Logic (presents the oldest frame first when the latency limit is reached)
+		pipeline.submit([&](FrameGeometry& geometry, const RenderTarget& target) {
+			buildFrame(target, proj, currentMode, time, scene, context, geometry);
+		}, present);
 	}
+	pipeline.finish(present);
+#endif
 	// Terminate the program successfully
 	return 0;
 }
 
-void rasterizeTriangle(GamesEngineeringBase::Window& canvas, const Triangle& t, std::vector<float> &zBuffer) {
-	Vec4 tr, bl;
-	findBounds(canvas, t.v0, t.v1, t.v2, tr, bl);
-
-	float projArea = edgeFunction(t.v0, t.v1, t.v2);
-	float area = 1.f / projArea;
-
-	for (int y = (int)bl.y; y < (int)tr.y + 1; y++) {
-		for (int x = (int)bl.x; x < (int)tr.x + 1; x++) {
-			Vec4 p(x + 0.5f, y + 0.5f, 0);
-
-			float alpha = edgeFunction(t.v1, t.v2, p);
-			float beta = edgeFunction(t.v2, t.v0, p);
-			float gamma = edgeFunction(t.v0, t.v1, p);
-
-			alpha *= area;
-			beta *= area;
-			gamma *= area;
-
-			if ((alpha >= 0 && alpha <= 1) && (beta >= 0 && beta <= 1) && (gamma >= 0 && gamma <= 1)) {
-				float currentZ = (alpha * t.v0.z) + (beta * t.v1.z) + (gamma * t.v2.z);
-				int index = y * WINDOW_WIDTH + x;
-
-				if (currentZ < zBuffer[index]) {
-					zBuffer[index] = currentZ;
-					float w0 = t.v0.w; float w1 = t.v1.w; float w2 = t.v2.w;
-					float frag_w = ((alpha * w0) + (beta * w1) + (gamma * w2));
-
-					Colour frag = perspectiveCorrectInterpolateAttribute(
-						Colour(0.f, 0.f, 1.f), Colour(0.f, 1.f, 0.f), Colour(1.f, 0.f, 0.f), // The attributes (Colors)
-						w0, w1, w2,															 // The 1/w values
-						alpha, beta, gamma,													 // The barycentric coordinates
-						frag_w																 // (alpha * w0) + (beta * w1) + (gamma * w2)
-					);
-					canvas.draw(x, y, frag.r * 255, frag.g * 255, frag.b * 255);
-				}
-			}
-		}
+// Geometry stage of one frame of the selected mode (camera, and for the scene the animation, instance culling,
+// vertex and primitive stages)
+void buildFrame(const RenderTarget& target, Matrix& proj, int mode, float time, Scene& scene, FrameContext& context, FrameGeometry& geometry) {
+	Transform view;
+	Vec3 eye(0.f, 0.f, 5.f);
+	if (mode >= 2) {
+		// Spinning Camera
+		float radius = 0.5f;
+		float camX = radius * cos(time);
+		float camZ = radius * sin(time);
+		eye = Vec3(camX, 0.f, camZ);
+		view = Transform::lookAt(eye, Vec3(0.f, 0.f, 0.f), Vec3(0.f, 1.f, 0.f));  // Look from (camX, 0, camZ) -> to Origin (0,0,0)
+	}
+	else view = Transform::lookAt(eye, Vec3(0.f, 0.f, 0.f), Vec3(0.f, 1.f, 0.f));   // Static Camera
+
+	geometry.mode = mode;
+	geometry.view = view.toMatrix();
+	geometry.batchCount = 0;
+	if (mode >= 2) {
+		animateScene(scene, time, context);
+		Matrix viewProj = proj * view;
+		assembleScene(target, viewProj, eye, scene, context, geometry);
 	}
 }
 
-void rasterizeTriangle(GamesEngineeringBase::Window& canvas, const Triangle& t, const Vec4& n0, const Vec4& n1, const Vec4& n2, std::vector<float>& zBuffer) {
-	Vec4 tr, bl;
-	findBounds(canvas, t.v0, t.v1, t.v2, tr, bl);
-
-	float projArea = edgeFunction(t.v0, t.v1, t.v2);
-	float area = 1.f / projArea;
-
-	Vec4 omega_i = Vec4(1.0f, 1.0f, 0.f, 1.f).normalize();  // Light Direction (e.g., Sun from top-right)
-	Colour rho(0.0f, 1.0f, 0.0f);							// Surface Color (Green Bunny)
-	Colour L(1.0f, 1.0f, 1.0f);								// Light Intensity (White)
-	Colour ambient(0.2f, 0.2f, 0.2f);						// Ambient Light (Grey)
-
-	for (int y = (int)bl.y; y < (int)tr.y + 1; y++) {
-		for (int x = (int)bl.x; x < (int)tr.x + 1; x++) {
-			Vec4 p(x + 0.5f, y + 0.5f, 0);
-
-			float alpha = edgeFunction(t.v1, t.v2, p);
-			float beta = edgeFunction(t.v2, t.v0, p);
-			float gamma = edgeFunction(t.v0, t.v1, p);
-
-			alpha *= area;
-			beta *= area;
-			gamma *= area;
-
-			if ((alpha >= 0 && alpha <= 1) && (beta >= 0 && beta <= 1) && (gamma >= 0 && gamma <= 1)) {
-				float currentZ = (alpha * t.v0.z) + (beta * t.v1.z) + (gamma * t.v2.z);
-				int index = y * WINDOW_WIDTH + x;
-
-				if (currentZ < zBuffer[index]) {
-					zBuffer[index] = currentZ;
-					float w0 = t.v0.w; float w1 = t.v1.w; float w2 = t.v2.w;
-					float frag_w = ((alpha * w0) + (beta * w1) + (gamma * w2));
+// Raster stage of one frame into any render target (already cleared)
+void rasterizeFrame(RenderTarget& target, Matrix& proj, FrameGeometry& geometry, FrameContext& context) {
+	if (geometry.mode == 0) renderLesson1_2D(target);
+	else if (geometry.mode == 1) renderLesson2_Projection(target, proj, geometry.view);
+	else if (geometry.mode == 2) rasterizeScene(target, geometry, context);
+	else if (geometry.mode == 3) rasterizeScene(target, geometry, context, &context.tiles);
+	else if (geometry.mode == 4) rasterizeScene(target, geometry, context, nullptr, &context.visibility);
+}
 
-					// Surface Normal
-					Vec4 N = perspectiveCorrectInterpolateAttribute<Vec4>(n0, n1, n2, w0, w1, w2, alpha, beta, gamma, frag_w).normalize();
+// Headless Batch Rendering (spinning camera at a fixed 60 Hz timestep, no window, present or message pump)
+int runHeadless(int frames, int mode, unsigned int width, unsigned int height, const std::string& output, Scene& scene, CullMode cullMode, DepthFormat depthFormat, unsigned int threads, unsigned int latency, bool meshletCulling, bool occlusionCulling) {
+	FrameContext context(threads);
+	context.cullMode = cullMode;
+	context.meshletCulling = meshletCulling;
+	context.occlusionCulling = occlusionCulling;
+	std::vector<std::unique_ptr<OffscreenRenderTarget>> targets;
+	std::vector<RenderTarget*> targetPointers;
+	for (unsigned int i = 0; i < latency; i++) {
+		targets.emplace_back(new OffscreenRenderTarget(width, height, depthFormat));
+		targetPointers.push_back(targets.back().get());
+	}
+	Matrix proj = Matrix::projection(*targets[0], 100.0f, 0.1f, 45.f);
 
-					// Lighting = (rho / PI) * (L * max(Dot(omega_i, N), 0) + ambient)
-					Colour finalColor = (rho / M_PI) * (L * std::max(Dot(omega_i, N), 0.f) + ambient);
+	RenderTarget* last = nullptr;  // Target of the last frame presented
+	auto present = [&](RenderTarget& target) {
+		target.present();
+		last = &target;
+	};
 
-					// Draw Pixel
-					canvas.draw(x, y, finalColor.r * 255.0f, finalColor.g * 255.0f, finalColor.b * 255.0f);
-				}
-			}
+	auto start = std::chrono::high_resolution_clock::now();
+	{
+		FramePipeline<FrameGeometry> pipeline(context.jobs, targetPointers, [&](FrameGeometry& geometry, RenderTarget& target) {
+			target.clear();
+			rasterizeFrame(target, proj, geometry, context);
+		});
+		for (int frame = 0; frame < frames; frame++) {
+			pipeline.submit([&](FrameGeometry& geometry, const RenderTarget& target) {
+				buildFrame(target, proj, mode, frame / 60.f, scene, context, geometry);
+			}, present);
 		}
+		pipeline.finish(present);
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	std::cout << frames << " frames at " << width << "x" << height << " (" << rasterKernelName() << " kernel, " << depthFormatName(depthFormat) << " depth, " << context.jobs.threadCount() << " threads, " << latency << " frames in flight): " << elapsed.count() / frames << " ms/frame" << std::endl;
+	if (context.sceneStats.instances > 0) context.sceneStats.print(std::cout, frames);
+	if (context.primitives.submitted > 0) context.primitives.print(std::cout, frames);
+	if (!output.empty() && !static_cast<OffscreenRenderTarget*>(last)->savePPM(output)) {
+		std::cout << "Failed to write " << output << std::endl;
+		return 1;
 	}
+	return 0;
 }
 
 // Draw 2D Rasterization
-static void renderLesson1_2D(GamesEngineeringBase::Window& canvas, std::vector<float> &zBuffer) {
+void renderLesson1_2D(RenderTarget& target) {
 	Vec4 v0(512.f, 184.f);
 	Vec4 v1(685.f, 484.f);
 	Vec4 v2(339.f, 484.f);
 	Triangle t(v0, v1, v2);
-	rasterizeTriangle(canvas, t, zBuffer);
+	rasterizeTriangle(target, t);
 }
 
 // Draw 3D Projection
-static void renderLesson2_Projection(GamesEngineeringBase::Window& canvas, Matrix& projMatrix, Matrix& viewMatrix, std::vector<float> &zBuffer) {
+void renderLesson2_Projection(RenderTarget& target, Matrix& projMatrix, Matrix& viewMatrix) {
 	Vec4 v0(0.0f, 0.3f, 1.0f);
 	Vec4 v1(0.3f, -0.3f, 1.0f);
 	Vec4 v2(-0.3f, -0.3f, 1.0f);
@@ -196,47 +368,365 @@ static void renderLesson2_Projection(GamesEngineeringBase::Window& canvas, Matri
 		Vec4 vClip = vProj.divideByW();
 
 		// Viewport Transform (-1..1 -> 0..Width)
-		float screenX = (vClip[0] + 1.0f) * 0.5f * canvas.getWidth();
-		float screenY = (1.f - (vClip[1] + 1.0f) * 0.5f) * canvas.getHeight();
+		float screenX = (vClip[0] + 1.0f) * 0.5f * target.getWidth();
+		float screenY = (1.f - (vClip[1] + 1.0f) * 0.5f) * target.getHeight();
 
 		// Return Transformed Vector
 		return Vec4(screenX, screenY, vClip[2], vClip[3]);
 	};
 
 	Triangle t(transform(v0), transform(v1), transform(v2));
-	rasterizeTriangle(canvas, t, zBuffer);
+	rasterizeTriangle(target, t);
 }
 
-// Render Bunny
-void renderBunny(GamesEngineeringBase::Window& canvas, Matrix& viewProj, const std::vector<Vec3> &vertices, const std::vector<Vec3>& normals, std::vector<float> &zBuffer) {
-	auto transformPos = [&](Vec3 v) -> Vec4 {
-		Vec4 v4(v.x, v.y, v.z, 1.f);
-		return viewProj.mul(v4); // Return Clip Space (Before Divide)
-	};
+// Draw meshes from GEM meshes (positions split into SIMD streams, normals and indices as in the GEM mesh), without
+// meshlets yet
+std::vector<DrawMesh> makeDrawMeshes(const std::vector<GEMLoader::GEMMesh>& gemMeshes) {
+	std::vector<DrawMesh> meshes(gemMeshes.size());
+	for (size_t i = 0; i < gemMeshes.size(); i++) {
+		const std::vector<GEMLoader::GEMStaticVertex>& vertices = gemMeshes[i].verticesStatic;
+		meshes[i].positions.reserve(vertices.size());
+		meshes[i].normals.reserve(vertices.size());
+		for (const GEMLoader::GEMStaticVertex& v : vertices) {
+			meshes[i].positions.push(v.position.x, v.position.y, v.position.z);
+			meshes[i].normals.push_back(Vec4(v.normal.x, v.normal.y, v.normal.z, 0.0f));
+		}
+		meshes[i].indices = gemMeshes[i].indices;
+	}
+	return meshes;
+}
 
-	auto toScreen = [&](Vec4 vClip) -> Vec4 {
-		Vec4 v = vClip.divideByW();
-		float screenX = (v[0] + 1.0f) * 0.5f * canvas.getWidth();
-		float screenY = (1.f - (v[1] + 1.0f) * 0.5f) * canvas.getHeight();
-		return Vec4(screenX, screenY, v[2], v[3]);
-	};
+// Meshlets of a draw mesh made from gemMesh, in index order so the triangles keep their order. They are built over
+// a welded copy of its vertices, so a mesh loaded without optimization (often three vertices per triangle) still
+// gets clusters that share vertices.
+void buildDrawMeshlets(const GEMLoader::GEMMesh& gemMesh, DrawMesh& mesh) {
+	std::vector<GEMLoader::GEMStaticVertex> vertices = gemMesh.verticesStatic;
+	std::vector<unsigned int> indices = gemMesh.indices;
+	weldVertices(vertices, indices);
+
+	std::vector<Vec3> positions(vertices.size());
+	for (size_t v = 0; v < vertices.size(); v++) positions[v] = Vec3(vertices[v].position.x, vertices[v].position.y, vertices[v].position.z);
+	std::vector<unsigned int> meshletVertices;
+	buildMeshlets(positions, indices, mesh.meshlets, meshletVertices, mesh.meshletTriangles);
+	mesh.meshletPositions.reserve(meshletVertices.size());
+	mesh.meshletNormals.reserve(meshletVertices.size());
+	for (unsigned int v : meshletVertices) {
+		mesh.meshletPositions.push(positions[v].x, positions[v].y, positions[v].z);
+		mesh.meshletNormals.push_back(Vec4(vertices[v].normal.x, vertices[v].normal.y, vertices[v].normal.z, 0.0f));
+	}
+}
+
+// Overdraw Estimate (fragments that pass the depth test per covered pixel, with back-face culling, averaged over
+// views from the six axis directions onto the meshes' bounding sphere)
+float measureOverdraw(const std::vector<DrawMesh>& meshes) {
+	Vec3 minimum(FLT_MAX, FLT_MAX, FLT_MAX), maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (const DrawMesh& mesh : meshes) {
+		for (size_t i = 0; i < mesh.positions.size(); i++) {
+			minimum = Vec3(std::min(minimum.x, mesh.positions.x[i]), std::min(minimum.y, mesh.positions.y[i]), std::min(minimum.z, mesh.positions.z[i]));
+			maximum = Vec3(std::max(maximum.x, mesh.positions.x[i]), std::max(maximum.y, mesh.positions.y[i]), std::max(maximum.z, mesh.positions.z[i]));
+		}
+	}
+	if (minimum.x > maximum.x) return 0.f;
+	Vec3 centre = (minimum + maximum) * 0.5f;
+	float radius = std::max((maximum - minimum).length() * 0.5f, 1e-3f);
+
+	OffscreenRenderTarget target(OVERDRAW_VIEW_SIZE, OVERDRAW_VIEW_SIZE);
+	Matrix proj = Matrix::projection(target, radius * 5.f, radius, 45.f);  // The sphere fits the view from 3 radii away
+	PrimitiveStats stats;
+	TransformedVertices transformed;
+	std::vector<unsigned char> covered(OVERDRAW_VIEW_SIZE * OVERDRAW_VIEW_SIZE);
+	size_t fragments = 0, pixels = 0;
+	const Vec3 directions[OVERDRAW_VIEWS] = { Vec3(1.f, 0.f, 0.f), Vec3(-1.f, 0.f, 0.f), Vec3(0.f, 1.f, 0.f), Vec3(0.f, -1.f, 0.f), Vec3(0.f, 0.f, 1.f), Vec3(0.f, 0.f, -1.f) };
+	for (const Vec3& direction : directions) {
+		Vec3 up = direction.y != 0.f ? Vec3(0.f, 0.f, 1.f) : Vec3(0.f, 1.f, 0.f);
+		Matrix viewProj = proj * Transform::lookAt(centre + direction * (radius * 3.f), centre, up);
+		target.clear();
+		std::fill(covered.begin(), covered.end(), 0);
+
+		VertexStage vertexStage(viewProj, target);
+		PrimitiveAssembler assembler(target, stats, CullMode::Back);
+		for (const DrawMesh& mesh : meshes) {
+			vertexStage.transform(mesh.positions, transformed);
+			const Vec4* clip = transformed.clip.data();
+			const Vec4* screen = transformed.screen.data();
+			for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+				unsigned int i0 = mesh.indices[i], i1 = mesh.indices[i + 1], i2 = mesh.indices[i + 2];
+				assembler.assemble(clip[i0], clip[i1], clip[i2], screen[i0], screen[i1], screen[i2], [&](const Triangle& t, const ClipVertex&, const ClipVertex&, const ClipVertex&) {
+					traverseTriangle(target, t, target.getBounds(), [&](int x, int y, float, float, float) {
+						fragments++;
+						unsigned char& c = covered[y * OVERDRAW_VIEW_SIZE + x];
+						pixels += c == 0;
+						c = 1;
+					});
+				});
+			}
+		}
+	}
+	return pixels > 0 ? static_cast<float>(fragments) / pixels : 0.f;
+}
+
+// Load a GEM model (kept indexed, every vertex is transformed once per frame), with its triangles reordered for the
+// vertex cache and overdraw and its vertices for fetch locality unless optimizeMeshes is off
+SceneModel loadModel(const std::string& filename, bool optimizeMeshes) {
+	std::vector<GEMLoader::GEMMesh> gemMeshes;
+	GEMLoader::GEMModelLoader loader;
+	loader.load(filename, gemMeshes);
+
+	SceneModel model;
+	model.filename = filename;
+	model.meshes = makeDrawMeshes(gemMeshes);
+
+	// Mesh Optimization
+	if (optimizeMeshes) {
+		size_t triangles = 0;
+		float acmrLoaded = 0.f, acmrWelded = 0.f, acmrAfter = 0.f;
+		float overdrawBefore = measureOverdraw(model.meshes);
+		for (GEMLoader::GEMMesh& mesh : gemMeshes) {
+			size_t count = mesh.indices.size() / 3;
+			triangles += count;
+			acmrLoaded += computeACMR(mesh.indices, mesh.verticesStatic.size()) * count;
+
+			// Welded but still in file order, so the reorder is measured apart from the weld
+			std::vector<GEMLoader::GEMStaticVertex> welded = mesh.verticesStatic;
+			std::vector<unsigned int> weldedIndices = mesh.indices;
+			weldVertices(welded, weldedIndices);
+			acmrWelded += computeACMR(weldedIndices, welded.size()) * count;
+
+			optimizeMesh(mesh.verticesStatic, mesh.indices);
+			acmrAfter += computeACMR(mesh.indices, mesh.verticesStatic.size()) * count;
+		}
+		model.meshes = makeDrawMeshes(gemMeshes);
+		if (triangles > 0) {
+			std::cout << "Mesh optimization of " << filename << ": ACMR " << acmrLoaded / triangles << " as loaded, " << acmrWelded / triangles << " welded -> " << acmrAfter / triangles
+					  << " (" << VERTEX_CACHE_SIZE << "-entry FIFO), overdraw " << overdrawBefore << " -> " << measureOverdraw(model.meshes) << " (" << OVERDRAW_VIEWS << " views)" << std::endl;
+		}
+	}
+
+	for (size_t i = 0; i < model.meshes.size(); i++) buildDrawMeshlets(gemMeshes[i], model.meshes[i]);
+	for (DrawMesh& mesh : model.meshes) buildEdgeNeighbours(mesh.positions, mesh.indices, mesh.edgeNeighbours);
+	for (const DrawMesh& mesh : model.meshes) {
+		for (size_t i = 0; i < mesh.positions.size(); i++) model.bounds.extend(Vec3(mesh.positions.x[i], mesh.positions.y[i], mesh.positions.z[i]));
+	}
+	return model;
+}
+
+// Load a GEM scene (instances of GEM models, each with a row-major world matrix, model paths relative to the scene
+// file), every model is loaded once however many instances use it
+bool loadScene(const std::string& filename, bool optimizeMeshes, Scene& scene) {
+	if (!std::ifstream(filename)) return false;
+	GEMLoader::GEMScene gemScene;
+	gemScene.load(filename);
+	size_t slash = filename.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+
+	std::map<std::string, size_t> models;  // Model index of each file name
+	std::vector<AABB> bounds;
+	for (const GEMLoader::GEMInstance& gemInstance : gemScene.instances) {
+		auto model = models.find(gemInstance.meshFilename);
+		if (model == models.end()) {
+			const std::string& name = gemInstance.meshFilename;
+			bool absolute = !name.empty() && (name[0] == '/' || name[0] == '\\' || name.find(':') != std::string::npos);
+			model = models.emplace(name, scene.models.size()).first;
+			scene.models.push_back(loadModel(absolute ? name : directory + name, optimizeMeshes));
+		}
+
+		SceneInstance instance;
+		instance.model = model->second;
+		instance.placement = Transform(gemInstance.w.m);
+		instance.world = instance.placement;
+		scene.instances.push_back(instance);
+		bounds.push_back(transformAABB(scene.models[instance.model].bounds, instance.world));
+	}
+	scene.bvh.build(bounds);
+	return true;
+}
+
+// Grid of count instances of one model on the xz-plane, centred on the origin (a single instance sits at the origin
+// untransformed), every ANIMATED_INSTANCE_STRIDE-th instance spins
+void makeInstanceGrid(const std::string& filename, size_t count, bool optimizeMeshes, Scene& scene) {
+	scene.models.push_back(loadModel(filename, optimizeMeshes));
+	size_t columns = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+	size_t rows = (count + columns - 1) / columns;
+	std::vector<AABB> bounds(count);
+	scene.instances.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		SceneInstance& instance = scene.instances[i];
+		float x = (static_cast<float>(i % columns) - (columns - 1) * 0.5f) * INSTANCE_SPACING;
+		float z = (static_cast<float>(i / columns) - (rows - 1) * 0.5f) * INSTANCE_SPACING;
+		instance.placement = Transform::translate(Vec3(x, 0.f, z));
+		instance.world = instance.placement;
+		instance.animated = i % ANIMATED_INSTANCE_STRIDE == ANIMATED_INSTANCE_STRIDE - 1;
+		bounds[i] = transformAABB(scene.models[0].bounds, instance.world);
+	}
+	scene.bvh.build(bounds);
+}
 
-	for (size_t i = 0; i < vertices.size(); i+=3) {
-		if (i + 2 >= vertices.size()) break;
-		Vec4 v0_clip = transformPos(vertices[i]);
-		Vec4 v1_clip = transformPos(vertices[i + 1]);
-		Vec4 v2_clip = transformPos(vertices[i + 2]);
+// Spin the animated instances about their own y-axis and refit the BVH over their new bounds
+void animateScene(Scene& scene, float time, FrameContext& context) {
+	for (size_t i = 0; i < scene.instances.size(); i++) {
+		SceneInstance& instance = scene.instances[i];
+		if (!instance.animated) continue;
+		instance.world = instance.placement * Transform::rotateOnYAxis(time);
+		scene.bvh.update(i, transformAABB(scene.models[instance.model].bounds, instance.world));
+	}
+	context.sceneStats.refitted += scene.bvh.refit();
+}
 
-		if (v0_clip.w < 0.1f || v1_clip.w < 0.1f || v2_clip.w < 0.1f) continue;
-		Vec4 v0 = toScreen(v0_clip);
-		Vec4 v1 = toScreen(v1_clip);
-		Vec4 v2 = toScreen(v2_clip);
+// Geometry stage of the scene (the BVH culls whole instances against the frustum, the largest visible ones are
+// rasterized into the occlusion buffer and the others tested against it, then batches of meshlets of the
+// remaining instances run as jobs: each meshlet is culled as a whole, then its vertices are transformed into a
+// scratch buffer and its triangles culled, clipped and set up into the batch's list of the frame)
+void assembleScene(const RenderTarget& target, const Matrix& viewProj, const Vec3& eye, const Scene& scene, FrameContext& context, FrameGeometry& geometry) {
+	// Frustum Culling (world bounds through the BVH)
+	std::vector<VisibleInstance>& visible = context.visible;
+	visible.clear();
+	context.sceneStats.instances += scene.instances.size();
+	context.sceneStats.nodes += scene.bvh.cull(Frustum(viewProj), [&](size_t index, bool inside) { visible.push_back({ index, inside, false }); });
+	context.sceneStats.visible += visible.size();
+
+	// Occlusion Buffer (the visible instances that look largest, with every mesh triangle primitive assembly keeps,
+	// a single instance hides too little of itself to pay for it)
+	bool occlusion = context.occlusionCulling && visible.size() > 1;
+	if (occlusion) {
+		context.occlusion.begin(target.getWidth(), target.getHeight());
+		std::vector<std::pair<float, size_t>> sizes;
+		for (size_t i = 0; i < visible.size(); i++) {
+			const AABB& bounds = scene.bvh.bounds(visible[i].instance);
+			float distance = std::max((bounds.centre() - eye).length(), 1e-6f);
+			float size = (bounds.maximum - bounds.minimum).length() * 0.5f / distance;
+			if (size >= OCCLUDER_MIN_SIZE) sizes.push_back({ size, i });
+		}
+		size_t occluders = std::min(sizes.size(), OCCLUDER_INSTANCES);
+		std::partial_sort(sizes.begin(), sizes.begin() + occluders, sizes.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first > b.first; });
+		for (size_t i = 0; i < occluders; i++) {
+			VisibleInstance& v = visible[sizes[i].second];
+			v.occluder = true;
+			const SceneInstance& instance = scene.instances[v.instance];
+			Matrix mvp = instance.world.isIdentity() ? viewProj : viewProj * instance.world;
+			FrontFace occluderFrontFace = instance.world.determinant() < 0.f ? FrontFace::CounterClockwise : FrontFace::Clockwise;
+			for (const DrawMesh& mesh : scene.models[instance.model].meshes) context.occlusion.addOccluder(mesh.positions, mesh.indices, mesh.edgeNeighbours, mvp, context.cullMode, occluderFrontFace);
+		}
+		context.occlusion.rasterize(context.jobs);
+		context.sceneStats.occluders += occluders;
+		occlusion = context.occlusion.occluderTriangles() > 0;
+	}
 
-		Vec4 n0(normals[i].x, normals[i].y, normals[i].z, 0.0f);
-		Vec4 n1(normals[i + 1].x, normals[i + 1].y, normals[i + 1].z, 0.0f);
-		Vec4 n2(normals[i + 2].x, normals[i + 2].y, normals[i + 2].z, 0.0f);
+	// Draws (the meshes of every instance that is not hidden, each with its batches)
+	std::vector<SceneDraw>& draws = context.draws;
+	draws.clear();
+	size_t batches = 0;
+	for (const VisibleInstance& v : visible) {
+		if (occlusion && !v.occluder && context.occlusion.occluded(scene.bvh.bounds(v.instance), viewProj)) {
+			context.sceneStats.occluded++;
+			continue;
+		}
 
-		Triangle t(v0, v1, v2);
-		rasterizeTriangle(canvas, t, n0, n1, n2, zBuffer);
+		// Culling and transforms in model space (the camera position goes through the inverse world transform, and a
+		// mirroring world transform flips which model-space winding ends up clockwise on screen)
+		const SceneInstance& instance = scene.instances[v.instance];
+		bool identity = instance.world.isIdentity();
+		Matrix mvp = identity ? viewProj : viewProj * instance.world;
+		Vec3 modelEye = identity ? eye : instance.world.inverse().mulPoint(eye);
+		FrontFace modelFrontFace = instance.world.determinant() < 0.f ? FrontFace::CounterClockwise : FrontFace::Clockwise;
+		for (const DrawMesh& mesh : scene.models[instance.model].meshes) {
+			draws.push_back({ &mesh, instance.world, identity, v.inside, batches, mvp, VertexStage(mvp, target), MeshletCuller(mvp, modelEye, context.cullMode, modelFrontFace) });
+			batches += (mesh.meshlets.size() + MESHLET_BATCH - 1) / MESHLET_BATCH;
+		}
 	}
-}
\ No newline at end of file
+
+	geometry.batchCount = batches;
+	if (geometry.batches.size() < batches) geometry.batches.resize(batches);
+	context.batchStats.assign(batches, PrimitiveStats());
+
+	context.jobs.parallelFor(0, batches, 1, [&](size_t begin, size_t end) {
+		Vec4 clip[MESHLET_MAX_VERTICES], screen[MESHLET_MAX_VERTICES];  // Post-transform buffer of one meshlet
+		for (size_t batch = begin; batch < end; batch++) {
+			// Draw of the batch (the last one that starts at or before it)
+			const SceneDraw& draw = *(std::upper_bound(draws.begin(), draws.end(), batch, [](size_t b, const SceneDraw& d) { return b < d.firstBatch; }) - 1);
+			const DrawMesh& mesh = *draw.mesh;
+			auto worldNormal = [&](const Vec4& n) {
+				if (draw.identity) return n;
+				Vec3 w = draw.world.mulNormal(Vec3(n.x, n.y, n.z));
+				return Vec4(w.x, w.y, w.z, 0.f);
+			};
+
+			std::vector<AssembledTriangle>& assembled = geometry.batches[batch];
+			assembled.clear();
+			PrimitiveStats& stats = context.batchStats[batch];
+			PrimitiveAssembler assembler(target, stats, context.cullMode);
+			size_t first = (batch - draw.firstBatch) * MESHLET_BATCH;
+			size_t last = std::min(mesh.meshlets.size(), first + MESHLET_BATCH);
+			for (size_t m = first; m < last; m++) {
+				const Meshlet& meshlet = mesh.meshlets[m];
+				if (context.meshletCulling) {
+					stats.clusters++;
+					if (!draw.inside && draw.culler.outsideFrustum(meshlet)) {
+						stats.clusterFrustum++;
+						continue;
+					}
+					if (draw.culler.culledSide(meshlet)) {
+						stats.clusterBackface++;
+						continue;
+					}
+				}
+				if (occlusion) {
+					AABB bounds;
+					bounds.extend(meshlet.centre - Vec3(meshlet.radius, meshlet.radius, meshlet.radius));
+					bounds.extend(meshlet.centre + Vec3(meshlet.radius, meshlet.radius, meshlet.radius));
+					if (context.occlusion.occluded(bounds, draw.mvp)) {
+						stats.clusterOccluded++;
+						continue;
+					}
+				}
+
+				// Vertex Stage (MVP + divide + viewport in one SIMD pass over the meshlet's vertices)
+				draw.vertexStage.transform(mesh.meshletPositions, meshlet.firstVertex, meshlet.firstVertex + meshlet.vertexCount, clip, screen);
+
+				// Primitive Stage (corners index the scratch buffer), primitive assembly culls and clips in clip space,
+				// clipped vertices get their normals rebuilt from the weights
+				const unsigned char* corners = &mesh.meshletTriangles[meshlet.firstTriangle * 3];
+				const Vec4* normals = &mesh.meshletNormals[meshlet.firstVertex];
+				for (unsigned int t = 0; t < meshlet.triangleCount; t++) {
+					unsigned int i0 = corners[t * 3], i1 = corners[t * 3 + 1], i2 = corners[t * 3 + 2];
+
+					assembler.assemble(clip[i0], clip[i1], clip[i2], screen[i0], screen[i1], screen[i2], [&](const Triangle& tri, const ClipVertex& a, const ClipVertex& b, const ClipVertex& c) {
+						Vec4 n0 = worldNormal(normals[i0]);
+						Vec4 n1 = worldNormal(normals[i1]);
+						Vec4 n2 = worldNormal(normals[i2]);
+						auto normal = [&](const ClipVertex& v) { return n0 * v.weights.x + n1 * v.weights.y + n2 * v.weights.z; };
+						assembled.push_back({ tri, normal(a), normal(b), normal(c) });
+					});
+				}
+			}
+		}
+	});
+	for (const PrimitiveStats& stats : context.batchStats) context.primitives += stats;
+}
+
+// Raster stage of the scene (binned into screen tiles and rasterized as tile jobs when tiles is given, or written to
+// the visibility buffer and shaded once per pixel afterwards when visibility is given)
+void rasterizeScene(RenderTarget& target, const FrameGeometry& geometry, FrameContext& context, TileRenderer* tiles, VisibilityBuffer* visibility) {
+	if (tiles) {
+		// Binning order only matters within a set and the sets are replayed in order, so each binning job fills one
+		// set from a contiguous run of batches
+		size_t sets = std::min(geometry.batchCount, static_cast<size_t>(context.jobs.threadCount()) * BIN_SETS_PER_THREAD);
+		tiles->begin(target, sets);
+		context.jobs.parallelFor(0, sets, 1, [&](size_t begin, size_t end) {
+			for (size_t set = begin; set < end; set++) {
+				for (size_t batch = set * geometry.batchCount / sets; batch < (set + 1) * geometry.batchCount / sets; batch++)
+					for (const AssembledTriangle& a : geometry.batches[batch]) tiles->submit(a.t, a.n0, a.n1, a.n2, set);
+			}
+		});
+		tiles->flush();
+		return;
+	}
+	// Forward and visibility writes depend on submission order
+	if (visibility) visibility->begin(target);
+	for (size_t batch = 0; batch < geometry.batchCount; batch++) {
+		for (const AssembledTriangle& a : geometry.batches[batch]) {
+			if (visibility) visibility->submit(a.t, a.n0, a.n1, a.n2);
+			else rasterizeTriangle(target, a.t, a.n0, a.n1, a.n2);
+		}
+	}
+	if (visibility) visibility->resolve();
+}